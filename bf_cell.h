@@ -0,0 +1,62 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+//
+// Helpers for BrainfuckRunners that are specialized, at C++ compile time, on
+// the width of the Brainfuck memory cells and on the behavior of "," at the
+// end of the input.
+
+#ifndef BF_CELL_H_
+#define BF_CELL_H_
+
+#include <cstdint>
+
+#include "bf_runner.h"
+
+// Evaluates "," for a cell of type CellType i.e. stores the next input byte in
+// *cell or applies kEofPolicy if there is no more input.
+template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+inline void read_cell(BrainfuckReader reader,
+                      void* reader_arg,
+                      CellType* cell) {
+  int c = reader(reader_arg);
+  if (c != kBrainfuckEOF) {
+    *cell = static_cast<uint8_t>(c);
+  } else if (kEofPolicy == kEofZero) {
+    *cell = 0;
+  } else if (kEofPolicy == kEofMinusOne) {
+    *cell = static_cast<CellType>(-1);
+  }
+}
+
+template <typename Specializations, typename CellType>
+typename Specializations::Result select_eof_specialization(
+    BrainfuckEofPolicy eof_policy) {
+  switch (eof_policy) {
+    case kEofMinusOne:
+      return Specializations::template get<CellType, kEofMinusOne>();
+    case kEofUnchanged:
+      return Specializations::template get<CellType, kEofUnchanged>();
+    default:
+      return Specializations::template get<CellType, kEofZero>();
+  }
+}
+
+// Returns Specializations::get<CellType, kEofPolicy>() where CellType is the
+// unsigned integer type with cell_bits bits (which must be 8, 16 or 32) and
+// kEofPolicy is eof_policy. This allows a runner to pick the specialization
+// of its templated execution code once, rather than checking the cell width
+// for every Brainfuck command.
+template <typename Specializations>
+typename Specializations::Result select_cell_specialization(
+    int cell_bits, BrainfuckEofPolicy eof_policy) {
+  switch (cell_bits) {
+    case 16:
+      return select_eof_specialization<Specializations, uint16_t>(eof_policy);
+    case 32:
+      return select_eof_specialization<Specializations, uint32_t>(eof_policy);
+    default:
+      return select_eof_specialization<Specializations, uint8_t>(eof_policy);
+  }
+}
+
+#endif  // BF_CELL_H_
@@ -18,9 +18,49 @@
 #include <unistd.h>
 #include <limits.h>
 
+#include <algorithm>
 #include <cstdint>
 
 #include "bf_compile_and_go.h"
+#include "bf_optimizer.h"
+
+using std::make_pair;
+
+// The maximum number of ops to execute when evaluating the part of the program
+// before the first ",".
+const size_t kPrefixEvaluationSteps = 10 * 1000 * 1000;
+// The number of cells that may be accessed when evaluating the part of the
+// program before the first ",".
+const size_t kPrefixEvaluationCells = 64 * 1024;
+// The number of bytes updated by a vector instruction i.e. the size of an SSE
+// register.
+const int kVectorBytes = 16;
+// The minimum number of bytes in a run of cells set to the same value for the
+// run to be set using "rep stos".
+const size_t kFillMinimumBytes = 256;
+
+// The minimum number of ops in each fragment when a program is compiled in
+// parallel. Smaller programs are compiled by a single thread.
+const size_t kParallelFragmentOps = 16 * 1024;
+// The number of ops in each fragment in pipelined mode. Smaller fragments let
+// execution start sooner but add a function call between fragments.
+const size_t kPipelinedFragmentOps = 4 * 1024;
+// The offset of EXIT in the code generated by generate_fragment_code i.e. the
+// size of the jmp over it.
+const int kFragmentExitOffset = 5;
+
+// The minimum number of ops in a loop (including the loop start and end) for
+// it to be shared by calling a single copy of its code. Calling a stub costs
+// a call, a return and a stack adjustment, which is only worthwhile when the
+// loop code is substantially larger.
+const size_t kMinSharedLoopOps = 6;
+
+// The combined effect of a run of kAdd and kSet ops on a single cell.
+struct CellChange {
+  // If true then the cell is set to value, otherwise value is added to it.
+  bool set;
+  uint32_t value;
+};
 
 typedef void*(*BrainfuckFunction)(BrainfuckWriter writer,
                                   void* write_arg,
@@ -28,6 +68,13 @@ typedef void*(*BrainfuckFunction)(BrainfuckWriter writer,
                                   void* read_arg,
                                   void* memory);
 
+// The same as BrainfuckFunction but also returns the side exit in rdx.
+typedef BrainfuckTraceResult(*BrainfuckTraceFunction)(BrainfuckWriter writer,
+                                                      void* write_arg,
+                                                      BrainfuckReader reader,
+                                                      void* read_arg,
+                                                      void* memory);
+
 // This is the main entry point for the implementation of "BrainfuckFunction".
 // It expects it's arguments to be passed as specified in:
 // http://www.x86-64.org/documentation/abi.pdf
@@ -45,16 +92,25 @@ const char START[] =
   "\x41\x56"              // push   r14  # r14 will store the "read" arg
   "\x55"                  // push   rbp  # rbp will store the "read_arg" arg
   "\x53"                  // push   rbx  # rbx will store the "memory" arg
+  "\x41\x57"              // push   r15  # r15 will store the stack pointer
 
   // Store the passed arguments into a callee-saved register.
   "\x49\x89\xfc"          // mov    r12,rdi   # write function => r12
   "\x49\x89\xf5"          // mov    r13,rsi   # write arg 1 =>  r13
   "\x49\x89\xd6"          // mov    r14,rdx   # read function => r14
   "\x48\x89\xcd"          // mov    rbp,rcx   # read arg 1 => rbp
-  "\x4c\x89\xc3";         // mov    rbx,r8    # BF memory => rbx
+  "\x4c\x89\xc3"          // mov    rbx,r8    # BF memory => rbx
+
+  // Remember the stack pointer so that EXIT can be reached from within a
+  // shared loop stub (see generate_loop_call_code) and keep the stack 16 byte
+  // aligned for calls to "read" and "write".
+  "\x49\x89\xe7"          // mov    r15,rsp
+  "\x48\x83\xec\x08";     // sub    rsp,8
 
 const char EXIT[] =
   "\x48\x89\xd8"          // mov    rbx,rax   # Store return value
+  "\x4c\x89\xfc"          // mov    rsp,r15
+  "\x41\x5f"              // pop    r15
   "\x5b"                  // pop    rbx
   "\x5d"                  // pop    rbp
   "\x41\x5e"              // pop    r14
@@ -62,55 +118,61 @@ const char EXIT[] =
   "\x41\x5c"              // pop    r12
   "\xc3";                 // retq
 
-// , [part1] rax = read(rdp); if (rax == 0) goto exit; ...
+// , [part1] eax = read(rbp); ...
 const char READ[] =
   "\x48\x89\xef"          // mov    rdi,rbp,
-  "\x41\xff\xd6"          // callq  *%r14
-  "\x48\x83\xf8\x00";     // cmp    rax,0
-  // <inserted by code>   // jl     exit
-
-// , [part2] ... *rbx = rax;
-const char READ_STORE[] =
-  "\x88\x03";         // mov    [rbx],al
+  "\x41\xff\xd6";         // callq  *%r14
+  // <inserted by code>   // <handle eax == EOF and store eax in [rbx]>
 
 // . rax = write(r13, rbx); if (rax != 1) goto exit;
 const char WRITE[] =
-  "\x4c\x89\xef"          // mov    rdi,r13
-  "\x48\x0f\xb6\x33"      // movzbq rsi,[%rbx]
+  "\x4c\x89\xef";         // mov    rdi,r13
+  // <inserted by code>   // movzx  rsi,[rbx]
+const char WRITE_CALL[] =
   "\x41\xff\xd4"          // callq  *%r12
   "\x48\x83\xf8\x01";     // cmp    rax,1
   // <inserted by code>   // jne    exit
 
-char LOOP_CMP[] =
-  "\x80\x3b\x00";         // cmpb   rbx,0
-
-
-static bool find_loop_end(string::const_iterator loop_start,
-                          string::const_iterator string_end,
-                          string::const_iterator* loop_end) {
-  int level = 1;
-  for (string::const_iterator it = loop_start+1; it != string_end; ++it) {
-    if (*it == '[') {
-      level += 1;
-    } else if (*it == ']') {
-      level -= 1;
-      if (level == 0) {
-        *loop_end = it;
-        return true;
-      }
+// Appends the opcode for an instruction operating on a memory cell. Most
+// instructions with 8-bit operands have a separate opcode from the 16/32-bit
+// form, which uses an operand-size prefix to select 16-bit operands.
+void BrainfuckCompileAndGo::add_cell_opcode(uint8_t byte_opcode,
+                                            uint8_t wide_opcode,
+                                            string* code) {
+  if (cell_bytes_ == 1) {
+    *code += static_cast<char>(byte_opcode);
+  } else {
+    if (cell_bytes_ == 2) {
+      *code += "\x66";  // Operand-size prefix.
     }
+    *code += static_cast<char>(wide_opcode);
   }
-  return false;
 }
 
-void BrainfuckCompileAndGo::add_jne_to_exit(string* code) {
-  *code += "\x0f\x85";                                               // jne ...
-  uint32_t relative_address = exit_offset_ - (code->size() + 4);
-  *code +=  string(reinterpret_cast<char *>(&relative_address), 4);  // ... exit
+// Appends the ModR/M byte (and displacement) for [rbx+offset*<cell size>].
+// reg is the value of the ModR/M "reg" field.
+void BrainfuckCompileAndGo::add_cell_address(uint8_t reg,
+                                             int32_t offset,
+                                             string* code) {
+  int32_t displacement = offset * cell_bytes_;
+  if (displacement == 0) {
+    *code += static_cast<char>(0x03 | (reg << 3));         // [rbx]
+  } else if (displacement >= INT8_MIN && displacement <= INT8_MAX) {
+    *code += static_cast<char>(0x43 | (reg << 3));         // [rbx+XX]
+    *code += static_cast<char>(displacement);
+  } else {
+    *code += static_cast<char>(0x83 | (reg << 3));         // [rbx+XXXXXXXX]
+    *code += string(reinterpret_cast<char *>(&displacement), 4);
+  }
 }
 
-void BrainfuckCompileAndGo::add_jl_to_exit(string* code) {
-  *code += "\x0f\x8c";                                               // jl ...
+// Appends an immediate operand that is the size of a cell.
+void BrainfuckCompileAndGo::add_cell_immediate(uint32_t value, string* code) {
+  *code += string(reinterpret_cast<char *>(&value), cell_bytes_);
+}
+
+void BrainfuckCompileAndGo::add_jne_to_exit(string* code) {
+  *code += "\x0f\x85";                                               // jne ...
   uint32_t relative_address = exit_offset_ - (code->size() + 4);
   *code +=  string(reinterpret_cast<char *>(&relative_address), 4);  // ... exit
 }
@@ -125,14 +187,170 @@ void BrainfuckCompileAndGo::add_jmp_to_exit(string* code) {
   add_jmp_to_offset(exit_offset_, code);
 }
 
-bool BrainfuckCompileAndGo::generate_loop_code(string::const_iterator start,
-                                               string::const_iterator end,
+// Appends a conditional jump (e.g. 0x84 for je) to the code for side_exit,
+// which is added by add_side_exits.
+void BrainfuckCompileAndGo::add_jump_to_side_exit(uint8_t condition_opcode,
+                                                  size_t side_exit,
+                                                  string* code) {
+  *code += "\x0f";                                           // jcc ...
+  *code += static_cast<char>(condition_opcode);
+  side_exit_jumps_.push_back(make_pair(code->size(), side_exit));
+  *code += string(4, '\0');                                  // ... side_exit
+}
+
+// Appends the code for each side exit of a trace and fills in the jumps to
+// them. Each side exit stores its number in rdx, which is returned with rax
+// as a BrainfuckTraceResult.
+void BrainfuckCompileAndGo::add_side_exits(string* code) {
+  map<size_t, size_t> side_exit_offsets;
+  for (auto it = side_exit_jumps_.begin();
+       it != side_exit_jumps_.end();
+       ++it) {
+    auto side_exit = side_exit_offsets.find(it->second);
+    if (side_exit == side_exit_offsets.end()) {
+      side_exit = side_exit_offsets.insert(
+          make_pair(it->second, code->size())).first;
+      uint32_t exit_number = it->second;
+      *code += "\xba";                                       // mov edx, ...
+      *code += string(
+          reinterpret_cast<char *>(&exit_number), 4);        // ... exit_number
+      add_jmp_to_exit(code);
+    }
+
+    uint32_t relative_address = side_exit->second - (it->first + 4);
+    code->replace(it->first, 4,
+                  string(reinterpret_cast<char *>(&relative_address), 4));
+  }
+}
+
+// Appends the fields of op that do not depend on its position to normalized.
+// A loop nested inside another loop is represented by its loop id (see
+// find_shared_loops) instead of its ops.
+static void append_normalized_op(const BrainfuckOp& op,
+                                 int32_t loop_id,
+                                 string* normalized) {
+  int32_t fields[3] = {op.opcode, op.offset, op.value};
+  if (op.opcode == kLoopStart) {
+    fields[1] = loop_id;
+  }
+  *normalized += string(reinterpret_cast<char *>(fields), sizeof(fields));
+}
+
+// Finds the loops in ops[start, end) that occur more than once and chooses
+// which of them to generate as stubs. Occurrences nested inside an earlier
+// copy of the same outer loop are not counted because the outer loop's code
+// will contain them too.
+//
+// Loops are identified bottom-up: each loop gets an id that is determined by
+// its own ops and the ids of the loops directly inside it, so loops have the
+// same id exactly when they have the same ops. This keeps the work and memory
+// proportional to the number of ops, however deeply the loops are nested.
+void BrainfuckCompileAndGo::find_shared_loops(const vector<BrainfuckOp>& ops,
+                                              size_t start,
+                                              size_t end) {
+  shared_loops_.clear();
+  stub_loop_starts_.clear();
+  stub_calls_.clear();
+  if (tracing_) {
+    return;
+  }
+
+  // The id of the loop starting at each op, indexed by op - start.
+  vector<int32_t> loop_ids(end - start, -1);
+  map<string, int32_t> normalized_loop_ids;
+  // The normalized ops of each loop that has been started but not ended.
+  vector<string> open_loops;
+  for (size_t i = start; i < end; ++i) {
+    if (ops[i].opcode == kLoopStart) {
+      open_loops.push_back(string());
+    } else if (ops[i].opcode == kLoopEnd) {
+      auto inserted = normalized_loop_ids.insert(
+          make_pair(open_loops.back(), normalized_loop_ids.size()));
+      open_loops.pop_back();
+      int32_t loop_id = inserted.first->second;
+      loop_ids[ops[i].match - start] = loop_id;
+      if (!open_loops.empty()) {
+        append_normalized_op(ops[ops[i].match], loop_id, &open_loops.back());
+      }
+    } else if (!open_loops.empty()) {
+      append_normalized_op(ops[i], -1, &open_loops.back());
+    }
+  }
+  normalized_loop_ids.clear();
+
+  map<int32_t, vector<size_t>> occurrences;
+  vector<int32_t> order;
+  for (size_t i = start; i < end; ++i) {
+    if (ops[i].opcode != kLoopStart ||
+        ops[i].match - i + 1 < kMinSharedLoopOps ||
+        (prefix_.resume_op >= i && prefix_.resume_op <= ops[i].match)) {
+      continue;
+    }
+
+    int32_t loop_id = loop_ids[i - start];
+    auto found = occurrences.find(loop_id);
+    if (found == occurrences.end()) {
+      occurrences[loop_id].push_back(i);
+      order.push_back(loop_id);
+    } else {
+      found->second.push_back(i);
+      i = ops[i].match;
+    }
+  }
+
+  for (auto it = order.begin(); it != order.end(); ++it) {
+    const vector<size_t>& loop_starts = occurrences[*it];
+    if (loop_starts.size() < 2) {
+      continue;
+    }
+    for (auto loop_start = loop_starts.begin();
+         loop_start != loop_starts.end();
+         ++loop_start) {
+      shared_loops_[*loop_start] = stub_loop_starts_.size();
+    }
+    stub_loop_starts_.push_back(loop_starts.front());
+  }
+}
+
+// Appends a call to the stub for a loop found by find_shared_loops. The
+// displacement is filled in by add_loop_stubs.
+void BrainfuckCompileAndGo::generate_loop_call_code(size_t stub,
+                                                    string* code) {
+  *code += "\xe8";                                           // call ...
+  stub_calls_.push_back(make_pair(code->size(), stub));
+  *code += string(4, '\0');                                  // ... stub
+}
+
+// Appends the code for each stub used by generate_loop_call_code and fills in
+// the calls to them. A stub runs the loop with the stack aligned for calls to
+// "read" and "write" and then returns. Writes that fail inside a stub jump
+// directly to EXIT, which restores the stack pointer saved by START.
+void BrainfuckCompileAndGo::add_loop_stubs(const vector<BrainfuckOp>& ops,
+                                           string* code) {
+  vector<size_t> stub_offsets;
+  for (size_t stub = 0; stub < stub_loop_starts_.size(); ++stub) {
+    stub_offsets.push_back(code->size());
+    *code += "\x48\x83\xec\x08";                             // sub rsp,8
+    generate_loop_code(ops, stub_loop_starts_[stub], code);
+    *code += "\x48\x83\xc4\x08";                             // add rsp,8
+    *code += "\xc3";                                         // ret
+  }
+
+  for (auto it = stub_calls_.begin(); it != stub_calls_.end(); ++it) {
+    uint32_t relative_address = stub_offsets[it->second] - (it->first + 4);
+    code->replace(it->first, 4,
+                  string(reinterpret_cast<char *>(&relative_address), 4));
+  }
+}
+
+void BrainfuckCompileAndGo::generate_loop_code(const vector<BrainfuckOp>& ops,
+                                               size_t loop_start_index,
                                                string* code) {
   // Converts a Brainfuck command sequence like this:
   // [<code>]
   // Into this:
   // loop_start:
-  //   cmpb   [rbx],0
+  //   cmp    [rbx],0   # Compares a byte, word or dword depending on cell size.
   //   je     loop_end
   //   <code>
   //   jmp    loop_start
@@ -140,15 +358,17 @@ bool BrainfuckCompileAndGo::generate_loop_code(string::const_iterator start,
   //
 
   int loop_start = code->size();
-  *code += string(LOOP_CMP, sizeof(LOOP_CMP) - 1);
+  generate_compare_zero_code(code);
 
   int jump_start = code->size();
   *code += string("\xde\xad\xbe\xef\xde\xad");  // Reserve 6 bytes for je.
 
-  if (!generate_sequence_code(start+1, end, code)) {
-    return false;
-  }
+  generate_sequence_code(ops, loop_start_index + 1, ops[loop_start_index].match,
+                         code);
 
+  if (ops[loop_start_index].match == prefix_.resume_op) {
+    resume_offset_ = code->size();
+  }
   add_jmp_to_offset(loop_start, code);  // Jump back to the start of the loop.
 
   string jump_to_end = "\x0f\x84";                              // je ...
@@ -158,155 +378,724 @@ bool BrainfuckCompileAndGo::generate_loop_code(string::const_iterator start,
       reinterpret_cast<char *>(&relative_end_of_loop), 4);      // ... loop_end
 
   code->replace(jump_start, jump_to_end.size(), jump_to_end);
-  return true;
+}
+
+void BrainfuckCompileAndGo::generate_compare_zero_code(string* code) {
+  add_cell_opcode(0x80, 0x83, code);                         // cmp ...
+  add_cell_address(7, 0, code);                              // ... [rbx],
+  *code += '\0';                                             // ... 0
 }
 
 void BrainfuckCompileAndGo::generate_read_code(string* code) {
   *code += string(READ, sizeof(READ) - 1);
-  add_jl_to_exit(code);
-  *code += string(READ_STORE, sizeof(READ_STORE) - 1);
+
+  // Stores eax, which contains a byte (0-255) or kBrainfuckEOF (-1), in the
+  // current cell. Storing kBrainfuckEOF sets all bits in the cell.
+  string store;
+  add_cell_opcode(0x88, 0x89, &store);                       // mov ...
+  add_cell_address(0, 0, &store);                            // ... [rbx],eax
+
+  switch (eof_policy_) {
+    case kEofZero:
+      *code += "\x83\xf8\xff";                               // cmp eax,-1
+      *code += "\x75\x02";                                   // jne store
+      *code += "\x31\xc0";                                   // xor eax,eax
+      break;
+    case kEofMinusOne:
+      break;
+    case kEofUnchanged:
+      *code += "\x83\xf8\xff";                               // cmp eax,-1
+      *code += "\x74";                                       // je ...
+      *code += static_cast<char>(store.size());              // ... after store
+      break;
+  }
+  *code += store;                                            // store:
 }
 
 void BrainfuckCompileAndGo::generate_write_code(string* code) {
   *code += string(WRITE, sizeof(WRITE) - 1);
-  add_jne_to_exit(code);
+  switch (cell_bytes_) {
+    case 1:
+      *code += "\x48\x0f\xb6\x33";                           // movzx rsi,[rbx]
+      break;
+    case 2:
+      *code += "\x48\x0f\xb7\x33";                           // movzx rsi,[rbx]
+      break;
+    default:
+      *code += "\x8b\x33";                                   // mov esi,[rbx]
+      break;
+  }
+  *code += string(WRITE_CALL, sizeof(WRITE_CALL) - 1);
+}
+
+// Appends the ModR/M byte and a RIP-relative displacement for the 16 byte
+// constant, which is stored in the constant pool after the generated code.
+// The displacement is filled in by add_vector_constants. reg is the value of
+// the ModR/M "reg" field.
+void BrainfuckCompileAndGo::add_vector_constant_address(uint8_t reg,
+                                                        const string& constant,
+                                                        string* code) {
+  auto it = vector_constant_offsets_.find(constant);
+  if (it == vector_constant_offsets_.end()) {
+    it = vector_constant_offsets_.insert(
+        make_pair(constant,
+                  vector_constant_offsets_.size() * kVectorBytes)).first;
+  }
+  *code += static_cast<char>(0x05 | (reg << 3));             // [rip+XXXXXXXX]
+  vector_constant_references_.push_back(
+      make_pair(code->size(), it->second));
+  *code += string(4, '\0');
+}
+
+// Appends the constant pool to the end of the generated code and fills in the
+// displacements that refer to it. The pool is aligned so that the constants
+// can be used as the memory operand of SSE instructions.
+void BrainfuckCompileAndGo::add_vector_constants(string* code) {
+  if (vector_constant_offsets_.empty()) {
+    return;
+  }
+
+  while (code->size() % kVectorBytes != 0) {
+    *code += "\xcc";                                         // int3
+  }
+  size_t pool_start = code->size();
+  code->resize(pool_start + vector_constant_offsets_.size() * kVectorBytes);
+  for (auto it = vector_constant_offsets_.begin();
+       it != vector_constant_offsets_.end();
+       ++it) {
+    code->replace(pool_start + it->second, kVectorBytes, it->first);
+  }
+
+  for (auto it = vector_constant_references_.begin();
+       it != vector_constant_references_.end();
+       ++it) {
+    // The displacement is the last part of each instruction that uses it.
+    uint32_t relative_address = pool_start + it->second - (it->first + 4);
+    code->replace(it->first, 4,
+                  string(reinterpret_cast<char *>(&relative_address), 4));
+  }
+}
+
+// Sets the cell at the given offset to value or adds value to it.
+void BrainfuckCompileAndGo::generate_cell_update_code(int32_t offset,
+                                                      bool set,
+                                                      uint32_t value,
+                                                      string* code) {
+  if (set) {
+    add_cell_opcode(0xc6, 0xc7, code);                       // mov ...
+    add_cell_address(0, offset, code);                       // ... [rbx+XX],
+    add_cell_immediate(value, code);                         // ... YY
+    return;
+  }
+
+  // The change, sign extended from the cell size.
+  int32_t change_value;
+  if (cell_bytes_ == 1) {
+    change_value = static_cast<int8_t>(value);
+  } else if (cell_bytes_ == 2) {
+    change_value = static_cast<int16_t>(value);
+  } else {
+    change_value = value;
+  }
+
+  if (cell_bytes_ != 1 &&
+      change_value >= INT8_MIN && change_value <= INT8_MAX) {
+    add_cell_opcode(0x80, 0x83, code);                       // add ...
+    add_cell_address(0, offset, code);                       // ... [rbx+XX],
+    *code += static_cast<char>(change_value);                // ... sign-ext YY
+  } else {
+    add_cell_opcode(0x80, 0x81, code);                       // add ...
+    add_cell_address(0, offset, code);                       // ... [rbx+XX],
+    add_cell_immediate(change_value, code);                  // ... YY
+  }
 }
 
-// Converts a table of updates to make to Brainfuck memory (using offsets
-// relative to the current datapointer location) into instructions. Resets
-// the datapointer offset and offset map.
+// Updates the kVectorBytes bytes of memory starting at the cell at the given
+// offset using:
+// memory = (memory & keep_mask) + change
+// where the addition is done separately for each cell. Cells that are set
+// have a zero keep_mask.
+void BrainfuckCompileAndGo::generate_vector_update_code(int32_t offset,
+                                                        const string& keep_mask,
+                                                        const string& change,
+                                                        string* code) {
+  const string all_bits(kVectorBytes, '\xff');
+  const string no_bits(kVectorBytes, '\0');
+
+  if (keep_mask == no_bits) {
+    if (change == no_bits) {
+      *code += "\x66\x0f\xef\xc0";                           // pxor xmm0,xmm0
+    } else {
+      *code += "\x66\x0f\x6f";                               // movdqa xmm0, ...
+      add_vector_constant_address(0, change, code);          // ... [rip+XX]
+    }
+  } else {
+    *code += "\xf3\x0f\x6f";                                 // movdqu xmm0, ...
+    add_cell_address(0, offset, code);                       // ... [rbx+XX]
+    if (keep_mask != all_bits) {
+      *code += "\x66\x0f\xdb";                               // pand xmm0, ...
+      add_vector_constant_address(0, keep_mask, code);       // ... [rip+XX]
+    }
+    if (change != no_bits) {
+      *code += "\x66\x0f";
+      if (cell_bytes_ == 1) {
+        *code += "\xfc";                                     // paddb xmm0, ...
+      } else if (cell_bytes_ == 2) {
+        *code += "\xfd";                                     // paddw xmm0, ...
+      } else {
+        *code += "\xfe";                                     // paddd xmm0, ...
+      }
+      add_vector_constant_address(0, change, code);          // ... [rip+XX]
+    }
+  }
+  *code += "\xf3\x0f\x7f";                                   // movdqu ...
+  add_cell_address(0, offset, code);                         // ... [rbx+XX],
+                                                             // ... xmm0
+}
+
+// Sets count cells, starting with the cell at the given offset, to value.
+void BrainfuckCompileAndGo::generate_fill_code(int32_t offset,
+                                               uint32_t count,
+                                               uint32_t value,
+                                               string* code) {
+  *code += "\x48\x8d";                                       // lea rdi, ...
+  add_cell_address(7, offset, code);                         // ... [rbx+XX]
+  *code += "\xb9";                                           // mov ecx, ...
+  *code += string(reinterpret_cast<char *>(&count), 4);      // ... count
+  if (value == 0) {
+    *code += "\x31\xc0";                                     // xor eax,eax
+  } else {
+    *code += "\xb8";                                         // mov eax, ...
+    *code += string(reinterpret_cast<char *>(&value), 4);    // ... value
+  }
+  if (cell_bytes_ == 1) {
+    *code += "\xf3\xaa";                                     // rep stosb
+  } else if (cell_bytes_ == 2) {
+    *code += "\x66\xf3\xab";                                 // rep stosw
+  } else {
+    *code += "\xf3\xab";                                     // rep stosd
+  }
+}
+
+// Converts a run of kAdd, kSet and kMove ops (using offsets relative to the
+// current datapointer location) into instructions.
 //
 // For example these Brainfuck commands:
 // "<<<++>>>--->++><>>+>>>"
 //
-// Would trigger this call:
-// emit_offset_table(
-//    &{{-3, 0x02}, {0, 0xfd}, {1, 0x02}, {2, 0x01}}, &5, code)
+// Would be parsed into these ops:
+// {kAdd -3 2}, {kAdd 0 -3}, {kAdd 1 2}, {kAdd 2 1}, {kMove 5}
 //
-// Which would add these instructions to code:
+// Which would add these instructions to code (for 8-bit cells):
 // addb [rbx-3],0x02   # Update each memory location with a single instruction.
 // addb [rbx],0xfd
 // addb [rbx+1],0x02
 // addb [rbx+2],0x01
-// add  rbx,2          # Move the data pointer to it's final offset.
-void BrainfuckCompileAndGo::emit_offset_table(
-    map<int8_t, uint8_t>* offset_to_change, int8_t* offset, string *code) {
-  for (auto it = offset_to_change->begin();
-       it != offset_to_change->end();
+// add  rbx,5          # Move the data pointer to it's final offset.
+//
+// The ops are first combined into a single change for each cell. Dense ranges
+// of changed cells are then updated kVectorBytes at a time using SSE2 (which
+// every amd64 processor supports) e.g. ">+>+>+>+>+>+>+>+>+>+>+>+>+>+>+>+" adds:
+// movdqu xmm0,[rbx+1]
+// paddb  xmm0,[rip+XX]  # A constant with 1 for every cell.
+// movdqu [rbx+1],xmm0
+//
+// Long runs of cells set to the same value, such as "[-]>[-]>[-]...", use
+// "rep stos".
+void BrainfuckCompileAndGo::emit_offset_table(const vector<BrainfuckOp>& ops,
+                                              size_t start,
+                                              size_t end,
+                                              string* code) {
+  const uint32_t cell_mask =
+      cell_bytes_ == 4 ? 0xffffffff : (1u << (cell_bytes_ * 8)) - 1;
+
+  // Maps offsets relative to the datapointer at the start of the table into
+  // the change to the cell at that offset.
+  map<int32_t, CellChange> offset_to_change;
+  int32_t position = 0;
+  for (size_t i = start; i < end; ++i) {
+    if (ops[i].opcode == kMove) {
+      position += ops[i].offset;
+      continue;
+    }
+
+    int32_t offset = position + ops[i].offset;
+    auto it = offset_to_change.find(offset);
+    if (ops[i].opcode == kSet || it == offset_to_change.end()) {
+      CellChange change = {ops[i].opcode == kSet, ops[i].value & cell_mask};
+      offset_to_change[offset] = change;
+    } else {
+      it->second.value = (it->second.value + ops[i].value) & cell_mask;
+    }
+  }
+
+  vector<pair<int32_t, CellChange>> changes;
+  for (auto it = offset_to_change.begin();
+       it != offset_to_change.end();
        ++it) {
-    int8_t change_offset = it->first;
-    uint8_t change_value = it->second;
+    if (it->second.set || it->second.value != 0) {
+      changes.push_back(*it);
+    }
+  }
+
+  const int32_t vector_cells = kVectorBytes / cell_bytes_;
+  size_t i = 0;
+  while (i < changes.size()) {
+    const int32_t offset = changes[i].first;
+    const CellChange& change = changes[i].second;
 
-    if (change_value == 0) {
+    if (change.set) {
+      size_t fill_end = i + 1;
+      while (fill_end < changes.size() &&
+             changes[fill_end].first == offset + static_cast<int32_t>(
+                 fill_end - i) &&
+             changes[fill_end].second.set &&
+             changes[fill_end].second.value == change.value) {
+        ++fill_end;
+      }
+      if ((fill_end - i) * cell_bytes_ >= kFillMinimumBytes) {
+        generate_fill_code(offset, fill_end - i, change.value, code);
+        i = fill_end;
+        continue;
+      }
+    }
+
+    // Only the cells between the first and last changed cells are updated by
+    // vector instructions, so that memory outside of the range that the
+    // Brainfuck program accesses is never touched.
+    size_t vector_end = i;
+    while (vector_end < changes.size() &&
+           changes[vector_end].first < offset + vector_cells) {
+      ++vector_end;
+    }
+    if (changes.back().first >= offset + vector_cells - 1 &&
+        static_cast<int32_t>(vector_end - i) * 2 >= vector_cells) {
+      string keep_mask(kVectorBytes, '\xff');
+      string vector_change(kVectorBytes, '\0');
+      for (size_t j = i; j < vector_end; ++j) {
+        size_t byte = (changes[j].first - offset) * cell_bytes_;
+        if (changes[j].second.set) {
+          keep_mask.replace(byte, cell_bytes_, cell_bytes_, '\0');
+        }
+        vector_change.replace(
+            byte, cell_bytes_,
+            reinterpret_cast<const char *>(&changes[j].second.value),
+            cell_bytes_);
+      }
+      generate_vector_update_code(offset, keep_mask, vector_change, code);
+      i = vector_end;
       continue;
     }
 
-    *code += "\x80\x43";                                  // addb [rbx+XX],YY
-    *code += string(reinterpret_cast<char *>(&change_offset), 1);  // XX
-    *code += string(reinterpret_cast<char *>(&change_value), 1);   // YY
+    generate_cell_update_code(offset, change.set, change.value, code);
+    ++i;
   }
 
-  if (*offset != 0) {
-    *code += "\x48\x83\xc3";                                // add rbx ...
-    *code += string(reinterpret_cast<char *>(offset), 1);   // ... offset
-    *offset = 0;
+  if (position != 0) {
+    int32_t displacement = position * cell_bytes_;
+    if (displacement >= INT8_MIN && displacement <= INT8_MAX) {
+      *code += "\x48\x83\xc3";                              // add rbx ...
+      *code += static_cast<char>(displacement);             // ... offset
+    } else {
+      *code += "\x48\x81\xc3";                              // add rbx ...
+      *code += string(reinterpret_cast<char *>(&displacement), 4);
+    }
   }
-  offset_to_change->clear();
 }
 
-bool BrainfuckCompileAndGo::generate_sequence_code(string::const_iterator start,
-                                                   string::const_iterator end,
-                                                   string* code) {
-  int8_t offset = 0;
-  // Maps offset relative to the datapointer into the amount to change it.
-  map<int8_t, uint8_t> offset_to_change;
+void BrainfuckCompileAndGo::generate_sequence_code(
+    const vector<BrainfuckOp>& ops, size_t start, size_t end, string* code) {
+  for (size_t i = start; i < end; ++i) {
+    if (i == prefix_.resume_op) {
+      resume_offset_ = code->size();
+    }
 
-  for (string::const_iterator it = start; it != end; ++it) {
-    switch (*it) {
-      case '<':
-        --offset;
-        if (offset == 127 || offset == -128) {
-          emit_offset_table(&offset_to_change, &offset, code);
-        }
-        break;
-      case '>':
-        ++offset;
-        if (offset == 127 || offset == -128) {
-          emit_offset_table(&offset_to_change, &offset, code);
+    switch (ops[i].opcode) {
+      case kAdd:
+      case kSet:
+      case kMove:
+        {
+          size_t table_end = i + 1;
+          while (table_end < end &&
+                 table_end != prefix_.resume_op &&
+                 (ops[table_end].opcode == kAdd ||
+                  ops[table_end].opcode == kSet ||
+                  ops[table_end].opcode == kMove)) {
+            ++table_end;
+          }
+          emit_offset_table(ops, i, table_end, code);
+          i = table_end - 1;
         }
         break;
-      case '-':
-        offset_to_change[offset] -= 1;
-        break;
-      case '+':
-        offset_to_change[offset] += 1;
-        break;
-      case ',':
-        emit_offset_table(&offset_to_change, &offset, code);
+      case kRead:
         generate_read_code(code);
         break;
-      case '.':
-        emit_offset_table(&offset_to_change, &offset, code);
+      case kWrite:
         generate_write_code(code);
-        break;
-      case '[':
-        emit_offset_table(&offset_to_change, &offset, code);
-        string::const_iterator loop_end;
-        if (!find_loop_end(it, end, &loop_end)) {
-          fprintf(
-              stderr,
-              "Unable to find loop end in block starting with: %s\n",
-              string(it, end).c_str());
-          return false;
+        if (tracing_) {
+          add_jump_to_side_exit(0x85, ops[i].match, code);  // jne side_exit
+        } else {
+          add_jne_to_exit(code);
         }
-        if (!generate_loop_code(it, loop_end, code)) {
-          return false;
+        break;
+      case kGuard:
+        generate_compare_zero_code(code);
+        // Leave if the cell is zero when it is expected to be non-zero (je)
+        // or non-zero when it is expected to be zero (jne).
+        add_jump_to_side_exit(ops[i].value ? 0x84 : 0x85, ops[i].match, code);
+        break;
+      case kGuardEqual:
+        add_cell_opcode(0x80, 0x81, code);                   // cmp ...
+        add_cell_address(7, 0, code);                        // ... [rbx],
+        add_cell_immediate(ops[i].value, code);              // ... value
+        add_jump_to_side_exit(0x85, ops[i].match, code);     // jne side_exit
+        break;
+      case kLoopStart:
+        {
+          auto shared_loop = shared_loops_.find(i);
+          if (shared_loop != shared_loops_.end()) {
+            generate_loop_call_code(shared_loop->second, code);
+          } else {
+            generate_loop_code(ops, i, code);
+          }
+          i = ops[i].match;
         }
-        it = loop_end;
+        break;
+      case kLoopEnd:
         break;
     }
   }
-  // The offset table must be emitted because this function is called
-  // recursively to handle loops.
-  emit_offset_table(&offset_to_change, &offset, code);
-  return true;
 }
 
 
-BrainfuckCompileAndGo::BrainfuckCompileAndGo() : executable_(NULL) {}
+// Generates the code for ops[start, end) into code, which must be empty. The
+// code can be placed at any 16 byte aligned offset. It starts by jumping over
+// its own copy of EXIT, which is the target of the jumps to exit within the
+// fragment, and ends by jumping over its loop stubs and vector constants to
+// whatever code follows it.
+void BrainfuckCompileAndGo::generate_fragment_code(
+    const vector<BrainfuckOp>& ops, size_t start, size_t end, string* code) {
+  resume_offset_ = -1;
+  vector_constant_offsets_.clear();
+  vector_constant_references_.clear();
+
+  *code += "\xe9";                                           // jmp ...
+  uint32_t relative_exit_end = sizeof(EXIT) - 1;
+  *code += string(
+      reinterpret_cast<char *>(&relative_exit_end), 4);       // ... after EXIT
+  exit_offset_ = code->size();
+  *code += string(EXIT, sizeof(EXIT) - 1);
+
+  find_shared_loops(ops, start, end);
+  generate_sequence_code(ops, start, end, code);
+  if (end == ops.size() && prefix_.resume_op == end) {
+    resume_offset_ = code->size();
+  }
+
+  int jump_offset = code->size();
+  *code += "\xde\xad\xbe\xef\xde";  // Reserve 5 bytes for jmp fragment_end.
+  add_loop_stubs(ops, code);
+  add_vector_constants(code);
+  while (code->size() % kVectorBytes != 0) {
+    *code += "\xcc";                                         // int3
+  }
+
+  string jump_to_end = "\xe9";                               // jmp ...
+  uint32_t relative_end = code->size() -
+      (jump_offset + jump_to_end.size() + 4);
+  jump_to_end += string(
+      reinterpret_cast<char *>(&relative_end), 4);           // ... fragment_end
+  code->replace(jump_offset, jump_to_end.size(), jump_to_end);
+}
 
-bool BrainfuckCompileAndGo::init(string::const_iterator start,
-                                 string::const_iterator end) {
+// Returns the code for a BrainfuckFunction that runs the given fragments in
+// order. The function starts at the resume point if one of the fragments
+// contains it and at the first fragment otherwise.
+string BrainfuckCompileAndGo::generate_function_code(
+    const vector<Fragment*>& fragments) {
   string code(START, sizeof(START) - 1);
-  code += "\xeb";  // relative jump;
-  code += sizeof(EXIT) - 1;
-  exit_offset_ = code.size();
-  code += string(EXIT, sizeof(EXIT) - 1);
+  int entry_jump_offset = code.size();
+  code += "\xde\xad\xbe\xef\xde";  // Reserve 5 bytes for jmp entry_point.
+  while (code.size() % kVectorBytes != 0) {
+    code += "\xcc";                                          // int3
+  }
 
-  if (!generate_sequence_code(start, end, &code)) {
-    return false;
+  int first_fragment_offset = code.size();
+  int entry_offset = -1;
+  for (auto it = fragments.begin(); it != fragments.end(); ++it) {
+    if (entry_offset == -1 && (*it)->resume_offset != -1) {
+      entry_offset = code.size() + (*it)->resume_offset;
+    }
+    code += (*it)->code;
+  }
+  if (entry_offset == -1) {
+    entry_offset = first_fragment_offset;
   }
-  add_jmp_to_exit(&code);
+  add_jmp_to_offset(first_fragment_offset + kFragmentExitOffset, &code);
+
+  string jump_to_entry = "\xe9";                             // jmp ...
+  uint32_t relative_entry = entry_offset -
+      (entry_jump_offset + jump_to_entry.size() + 4);
+  jump_to_entry += string(
+      reinterpret_cast<char *>(&relative_entry), 4);         // ... entry_point
+  code.replace(entry_jump_offset, jump_to_entry.size(), jump_to_entry);
+  return code;
+}
 
-  executable_size_ = (code.size() /
+// Copies code into newly allocated executable memory.
+bool BrainfuckCompileAndGo::make_executable(const string& code,
+                                            void** executable,
+                                            size_t* executable_size) {
+  *executable_size = (code.size() /
                       sysconf(_SC_PAGESIZE) + 1) * sysconf(_SC_PAGESIZE);
 
-  executable_ = mmap(
+  *executable = mmap(
       NULL,
-      executable_size_,
+      *executable_size,
       PROT_READ | PROT_WRITE,
       MAP_PRIVATE | MAP_ANON, -1, 0);
-  if (executable_ == MAP_FAILED) {
+  if (*executable == MAP_FAILED) {
+    *executable = NULL;
     fprintf(stderr, "Error making memory executable: %s\n", strerror(errno));
     return false;
   }
 
-  memmove(executable_, code.data(), code.size());
-  if (mprotect(executable_, executable_size_, PROT_EXEC | PROT_READ) != 0) {
+  memmove(*executable, code.data(), code.size());
+  if (mprotect(*executable, *executable_size, PROT_EXEC | PROT_READ) != 0) {
     fprintf(stderr, "mprotect failed: %s\n", strerror(errno));
     return false;
   }
+  return true;
+}
+
+// Divides the top-level ops, starting at first_op, into fragments of at least
+// fragment_ops ops (except for the last). There is always at least one
+// fragment, even if it is empty.
+void BrainfuckCompileAndGo::split_into_fragments(size_t first_op,
+                                                 size_t fragment_ops) {
+  fragments_.clear();
+  size_t fragment_start = first_op;
+  size_t i = first_op;
+  do {
+    if (i < ops_.size()) {
+      i = (ops_[i].opcode == kLoopStart ? ops_[i].match : i) + 1;
+    }
+    if (i - fragment_start >= fragment_ops || i == ops_.size()) {
+      Fragment* fragment = new Fragment();
+      fragment->start_op = fragment_start;
+      fragment->end_op = i;
+      fragment->resume_offset = -1;
+      fragment->executable = NULL;
+      fragment->executable_size = 0;
+      fragment->compiled = false;
+      fragment->runnable = false;
+      fragments_.push_back(unique_ptr<Fragment>(fragment));
+      fragment_start = i;
+    }
+  } while (i < ops_.size());
+}
+
+// Compiles fragments, in order, until there are none left. Run by each
+// compilation thread.
+void BrainfuckCompileAndGo::compile_fragments() {
+  while (!cancelled_) {
+    size_t index = next_fragment_++;
+    if (index >= fragments_.size()) {
+      return;
+    }
+    Fragment* fragment = fragments_[index].get();
+
+    // Code generation keeps its state in the BrainfuckCompileAndGo so each
+    // fragment is generated by a separate instance.
+    BrainfuckCompileAndGo generator(cell_bytes_ * 8, eof_policy_,
+                                    zeroed_memory_, false);
+    generator.prefix_.resume_op = prefix_.resume_op;
+    generator.generate_fragment_code(ops_, fragment->start_op,
+                                     fragment->end_op, &fragment->code);
+    fragment->resume_offset = generator.resume_offset_;
+
+    if (pipelined_) {
+      bool runnable = make_executable(generate_function_code({fragment}),
+                                      &fragment->executable,
+                                      &fragment->executable_size);
+      pthread_mutex_lock(&compilation_mutex_);
+      fragment->runnable = runnable;
+      fragment->compiled = true;
+      pthread_cond_broadcast(&fragment_compiled_);
+      pthread_mutex_unlock(&compilation_mutex_);
+    }
+  }
+}
+
+void* BrainfuckCompileAndGo::compilation_thread(void* compiler) {
+  reinterpret_cast<BrainfuckCompileAndGo *>(compiler)->compile_fragments();
+  return NULL;
+}
+
+void BrainfuckCompileAndGo::start_compilation_threads(size_t thread_count) {
+  for (size_t i = 0; i < thread_count; ++i) {
+    pthread_t thread;
+    int error = pthread_create(&thread, NULL, compilation_thread, this);
+    if (error != 0) {
+      // The remaining fragments will be compiled by the threads that did
+      // start or, if there are none, by the current thread.
+      fprintf(stderr, "pthread_create failed: %s\n", strerror(error));
+      break;
+    }
+    compilation_threads_.push_back(thread);
+  }
+}
+
+void BrainfuckCompileAndGo::join_compilation_threads() {
+  for (auto it = compilation_threads_.begin();
+       it != compilation_threads_.end();
+       ++it) {
+    pthread_join(*it, NULL);
+  }
+  compilation_threads_.clear();
+}
+
+BrainfuckCompileAndGo::BrainfuckCompileAndGo(int cell_bits,
+                                             BrainfuckEofPolicy eof_policy,
+                                             bool zeroed_memory,
+                                             bool pipelined) :
+    cell_bytes_(cell_bits / 8),
+    eof_policy_(eof_policy),
+    zeroed_memory_(zeroed_memory),
+    pipelined_(pipelined),
+    fragment_ops_(0),
+    failed_(false),
+    executable_(NULL),
+    next_fragment_(0),
+    cancelled_(false),
+    tracing_(false) {
+  pthread_mutex_init(&compilation_mutex_, NULL);
+  pthread_cond_init(&fragment_compiled_, NULL);
+}
+
+bool BrainfuckCompileAndGo::init(const char* start, const char* end) {
+  ops_.clear();
+  if (!parse_brainfuck(start, end, &ops_)) {
+    return false;
+  }
+  optimize_brainfuck(cell_bytes_ * 8, zeroed_memory_, &ops_);
+
+  prefix_ = BrainfuckPrefix();
+  if (zeroed_memory_) {
+    evaluate_prefix(ops_, cell_bytes_ * 8, kPrefixEvaluationSteps,
+                    kPrefixEvaluationCells, &prefix_);
+  }
+
+  // Code before the top-level command containing the resume point can never
+  // be executed.
+  size_t first_op = 0;
+  while (first_op < prefix_.resume_op) {
+    size_t next_op = (ops_[first_op].opcode == kLoopStart ?
+                      ops_[first_op].match : first_op) + 1;
+    if (next_op > prefix_.resume_op) {
+      break;
+    }
+    first_op = next_op;
+  }
+
+  size_t thread_count = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+  if (fragment_ops_ != 0) {
+    split_into_fragments(first_op, fragment_ops_);
+  } else if (pipelined_) {
+    split_into_fragments(first_op, kPipelinedFragmentOps);
+  } else {
+    split_into_fragments(
+        first_op,
+        std::max(kParallelFragmentOps,
+                 (ops_.size() - first_op) / thread_count + 1));
+  }
+  thread_count = std::min(thread_count, fragments_.size());
+  next_fragment_ = 0;
+
+  if (pipelined_) {
+    start_compilation_threads(thread_count);
+    if (compilation_threads_.empty()) {
+      compile_fragments();
+    }
+    return true;
+  }
+
+  // The current thread compiles fragments too.
+  start_compilation_threads(thread_count - 1);
+  compile_fragments();
+  join_compilation_threads();
+
+  vector<Fragment*> fragments;
+  for (auto it = fragments_.begin(); it != fragments_.end(); ++it) {
+    fragments.push_back(it->get());
+  }
+  return make_executable(generate_function_code(fragments),
+                         &executable_,
+                         &executable_size_);
+}
+
+bool BrainfuckCompileAndGo::init_trace(const vector<BrainfuckOp>& trace,
+                                       bool repeat,
+                                       uint64_t end_exit) {
+  vector<BrainfuckOp> ops(trace);
+  optimize_brainfuck(cell_bytes_ * 8, false, &ops);
+
+  tracing_ = true;
+  prefix_ = BrainfuckPrefix();
+  resume_offset_ = -1;
+  vector_constant_offsets_.clear();
+  vector_constant_references_.clear();
+  side_exit_jumps_.clear();
+
+  string code(START, sizeof(START) - 1);
+  code += "\xe9";                                            // jmp ...
+  uint32_t relative_exit_end = sizeof(EXIT) - 1;
+  code += string(
+      reinterpret_cast<char *>(&relative_exit_end), 4);       // ... after EXIT
+  exit_offset_ = code.size();
+  code += string(EXIT, sizeof(EXIT) - 1);
+
+  int trace_start = code.size();
+  generate_sequence_code(ops, 0, ops.size(), &code);
+  if (repeat) {
+    add_jmp_to_offset(trace_start, &code);
+  } else {
+    uint32_t exit_number = end_exit;
+    code += "\xba";                                          // mov edx, ...
+    code += string(
+        reinterpret_cast<char *>(&exit_number), 4);          // ... end_exit
+    add_jmp_to_exit(&code);
+  }
+  add_side_exits(&code);
+  add_vector_constants(&code);
+
+  return make_executable(code, &executable_, &executable_size_);
+}
 
+BrainfuckTraceResult BrainfuckCompileAndGo::run_trace(BrainfuckReader reader,
+                                                      void* reader_arg,
+                                                      BrainfuckWriter writer,
+                                                      void* writer_arg,
+                                                      void* memory) {
+  return ((BrainfuckTraceFunction)executable_)(
+      writer, writer_arg, reader, reader_arg, memory);
+}
+
+// Wraps the writer passed to "run" in pipelined mode so that a failed write,
+// which ends a fragment, can be distinguished from the fragment finishing.
+struct PipelinedWriter {
+  BrainfuckWriter writer;
+  void* writer_arg;
+  bool failed;
+};
+
+static bool pipelined_write(void* writer_arg, char c) {
+  PipelinedWriter* pipelined_writer =
+      reinterpret_cast<PipelinedWriter *>(writer_arg);
+  if (!pipelined_writer->writer(pipelined_writer->writer_arg, c)) {
+    pipelined_writer->failed = true;
+    return false;
+  }
   return true;
 }
 
@@ -315,16 +1104,70 @@ void* BrainfuckCompileAndGo::run(BrainfuckReader reader,
                                  BrainfuckWriter writer,
                                  void* writer_arg,
                                  void* memory) {
-  return ((BrainfuckFunction)executable_)(
-      writer, writer_arg, reader, reader_arg, memory);
+  failed_ = false;
+
+  // Replay the effects of the code that was evaluated in "init".
+  for (string::const_iterator it = prefix_.output.begin();
+       it != prefix_.output.end();
+       ++it) {
+    if (!writer(writer_arg, *it)) {
+      return memory;
+    }
+  }
+  memmove(memory, prefix_.memory.data(), prefix_.memory.size());
+  memory = reinterpret_cast<char *>(memory) +
+      prefix_.data_pointer * cell_bytes_;
+
+  if (!pipelined_) {
+    return ((BrainfuckFunction)executable_)(
+        writer, writer_arg, reader, reader_arg, memory);
+  }
+
+  PipelinedWriter pipelined_writer = {writer, writer_arg, false};
+  for (auto it = fragments_.begin(); it != fragments_.end(); ++it) {
+    pthread_mutex_lock(&compilation_mutex_);
+    while (!(*it)->compiled) {
+      pthread_cond_wait(&fragment_compiled_, &compilation_mutex_);
+    }
+    pthread_mutex_unlock(&compilation_mutex_);
+    if (!(*it)->runnable) {
+      // make_executable has already reported the error.
+      failed_ = true;
+      break;
+    }
+    memory = ((BrainfuckFunction)(*it)->executable)(
+        pipelined_write, &pipelined_writer, reader, reader_arg, memory);
+    if (pipelined_writer.failed) {
+      break;
+    }
+  }
+  return memory;
+}
+
+void BrainfuckCompileAndGo::set_fragment_ops(size_t fragment_ops) {
+  fragment_ops_ = fragment_ops;
+}
+
+bool BrainfuckCompileAndGo::failed() const {
+  return failed_;
 }
 
 BrainfuckCompileAndGo::~BrainfuckCompileAndGo() {
+  cancelled_ = true;
+  join_compilation_threads();
+
   if (executable_) {
     if (munmap(executable_, executable_size_) != 0) {
       fprintf(stderr, "munmap failed: %s\n", strerror(errno));
     }
   }
+  for (auto it = fragments_.begin(); it != fragments_.end(); ++it) {
+    if ((*it)->executable) {
+      if (munmap((*it)->executable, (*it)->executable_size) != 0) {
+        fprintf(stderr, "munmap failed: %s\n", strerror(errno));
+      }
+    }
+  }
+  pthread_cond_destroy(&fragment_compiled_);
+  pthread_mutex_destroy(&compilation_mutex_);
 }
-
-
@@ -8,45 +8,206 @@
 #ifndef BF_COMPILE_AND_GO_H_
 #define BF_COMPILE_AND_GO_H_
 
+#include <pthread.h>
+
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "bf_ir.h"
+#include "bf_prefix.h"
 #include "bf_runner.h"
 
-using std::string;
 using std::map;
+using std::pair;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+// The result of running a compiled trace.
+struct BrainfuckTraceResult {
+  // The data pointer when the trace was left.
+  void* memory;
+  // The side exit that was taken.
+  uint64_t exit;
+};
 
 class BrainfuckCompileAndGo : public BrainfuckRunner {
  public:
-  BrainfuckCompileAndGo();
-  virtual bool init(string::const_iterator start,
-                    string::const_iterator end);
+  // cell_bits must be 8, 16 or 32. The generated code operates directly on
+  // cells of that width.
+  // If zeroed_memory is true then the memory passed to "run" must be zeroed.
+  // This allows "init" to optimize based on the initial cell values and to
+  // run the code until it first requires input (within limits). "run" then
+  // replays the output and memory changes and continues from that point.
+  // Loops that occur more than once in the program are generated once and
+  // called wherever they occur.
+  // Large programs are split into fragments at top-level loop boundaries and
+  // the fragments are compiled in parallel. If pipelined is true then "init"
+  // returns before compilation is complete and "run" starts executing the
+  // first fragment while later fragments are still being compiled.
+  BrainfuckCompileAndGo(int cell_bits,
+                        BrainfuckEofPolicy eof_policy,
+                        bool zeroed_memory,
+                        bool pipelined);
+  virtual bool init(const char* start, const char* end);
   virtual void* run(BrainfuckReader reader,
                     void* reader_arg,
                     BrainfuckWriter writer,
                     void* writer_arg,
                     void* memory);
 
+  virtual bool failed() const;
+
+  // Splits the program into fragments of about fragment_ops ops, rather than
+  // choosing the size based on the program size and the number of processors.
+  // Must be called before "init". Used to test programs with many fragments.
+  void set_fragment_ops(size_t fragment_ops);
+
+  // Compiles a trace, which is a sequence of ops without loops. If repeat is
+  // true then the trace is repeated until a kGuard, kGuardEqual or kWrite
+  // fails. Otherwise it is run once and, if none fail, leaves with the side
+  // exit end_exit. Use "run_trace" rather than "run" to execute it.
+  bool init_trace(const vector<BrainfuckOp>& trace,
+                  bool repeat,
+                  uint64_t end_exit);
+  // Runs the compiled trace and returns the side exit (the "match" field of
+  // the op that failed or end_exit) that it left through.
+  BrainfuckTraceResult run_trace(BrainfuckReader reader,
+                                 void* reader_arg,
+                                 BrainfuckWriter writer,
+                                 void* writer_arg,
+                                 void* memory);
+
   virtual ~BrainfuckCompileAndGo();
 
  private:
-  int executable_size_;
+  // A range of top-level ops that is compiled independently of the others.
+  struct Fragment {
+    size_t start_op;
+    size_t end_op;
+    // The generated code, which can be placed at any 16 byte aligned offset.
+    string code;
+    // The offset in code of prefix_.resume_op or -1.
+    int resume_offset;
+    // In pipelined mode, the fragment compiled as a complete
+    // BrainfuckFunction.
+    void* executable;
+    size_t executable_size;
+    // In pipelined mode, set (while holding compilation_mutex_) when
+    // executable is ready or could not be created.
+    bool compiled;
+    // True if executable was successfully created.
+    bool runnable;
+  };
+
+  const int cell_bytes_;
+  const BrainfuckEofPolicy eof_policy_;
+  const bool zeroed_memory_;
+  const bool pipelined_;
+  // The number of ops per fragment or 0 to choose automatically.
+  size_t fragment_ops_;
+  // True if the last call to "run" stopped because a fragment could not be
+  // compiled (in pipelined mode).
+  bool failed_;
+  size_t executable_size_;
   void* executable_;
   int exit_offset_;
+  // The optimized program. Only needed after "init" returns in pipelined mode.
+  vector<BrainfuckOp> ops_;
+  vector<unique_ptr<Fragment>> fragments_;
+  // The index of the next fragment for a compilation thread to compile.
+  std::atomic<size_t> next_fragment_;
+  // Set to stop the compilation threads from starting new fragments.
+  std::atomic<bool> cancelled_;
+  vector<pthread_t> compilation_threads_;
+  // Signalled, with compilation_mutex_ held, when a fragment is compiled in
+  // pipelined mode.
+  pthread_mutex_t compilation_mutex_;
+  pthread_cond_t fragment_compiled_;
+  // The state of the program when "run" starts executing generated code.
+  BrainfuckPrefix prefix_;
+  // The offset in the generated code of prefix_.resume_op.
+  int resume_offset_;
+  // Maps each 16 byte constant used by vector instructions to its offset in
+  // the constant pool that follows the generated code.
+  map<string, size_t> vector_constant_offsets_;
+  // The offsets, in the generated code, of the RIP-relative displacements
+  // that refer to each constant pool offset.
+  vector<pair<size_t, size_t>> vector_constant_references_;
+  // True if a trace is being compiled.
+  bool tracing_;
+  // The offsets, in the generated code, of the displacements of the jumps to
+  // each side exit of a trace.
+  vector<pair<size_t, size_t>> side_exit_jumps_;
+  // Maps the index of each kLoopStart op whose loop is generated as a shared
+  // stub to the index of the stub.
+  map<size_t, size_t> shared_loops_;
+  // The index of the kLoopStart op whose loop is generated for each stub.
+  vector<size_t> stub_loop_starts_;
+  // The offsets, in the generated code, of the displacements of the calls to
+  // each stub.
+  vector<pair<size_t, size_t>> stub_calls_;
 
+  void add_cell_opcode(uint8_t byte_opcode, uint8_t wide_opcode, string* code);
+  void add_cell_address(uint8_t reg, int32_t offset, string* code);
+  void add_cell_immediate(uint32_t value, string* code);
   void add_jne_to_exit(string* code);
-  void add_jl_to_exit(string* code);
   void add_jmp_to_offset(int offset, string* code);
   void add_jmp_to_exit(string* code);
-  void emit_offset_table(map<int8_t, uint8_t>* offset_to_change,
-                         int8_t* offset,
-                         string *code);
-  bool generate_sequence_code(string::const_iterator start,
-                              string::const_iterator end,
+  void add_jump_to_side_exit(uint8_t condition_opcode,
+                             size_t side_exit,
+                             string* code);
+  void add_side_exits(string* code);
+  void find_shared_loops(const vector<BrainfuckOp>& ops,
+                         size_t start,
+                         size_t end);
+  void generate_loop_call_code(size_t stub, string* code);
+  void add_loop_stubs(const vector<BrainfuckOp>& ops, string* code);
+  void add_vector_constant_address(uint8_t reg,
+                                   const string& constant,
+                                   string* code);
+  void add_vector_constants(string* code);
+  void split_into_fragments(size_t first_op, size_t fragment_ops);
+  void compile_fragments();
+  static void* compilation_thread(void* compiler);
+  void start_compilation_threads(size_t thread_count);
+  void join_compilation_threads();
+  string generate_function_code(const vector<Fragment*>& fragments);
+  static bool make_executable(const string& code,
+                              void** executable,
+                              size_t* executable_size);
+  void generate_fragment_code(const vector<BrainfuckOp>& ops,
+                              size_t start,
+                              size_t end,
+                              string* code);
+  void generate_cell_update_code(int32_t offset,
+                                 bool set,
+                                 uint32_t value,
+                                 string* code);
+  void generate_vector_update_code(int32_t offset,
+                                   const string& keep_mask,
+                                   const string& change,
+                                   string* code);
+  void generate_fill_code(int32_t offset,
+                          uint32_t count,
+                          uint32_t value,
+                          string* code);
+  void emit_offset_table(const vector<BrainfuckOp>& ops,
+                         size_t start,
+                         size_t end,
+                         string* code);
+  void generate_sequence_code(const vector<BrainfuckOp>& ops,
+                              size_t start,
+                              size_t end,
                               string* code);
-  bool generate_loop_code(string::const_iterator start,
-                          string::const_iterator end,
+  void generate_loop_code(const vector<BrainfuckOp>& ops,
+                          size_t loop_start_index,
                           string* code);
+  void generate_compare_zero_code(string* code);
   void generate_read_code(string* code);
   void generate_write_code(string* code);
 };
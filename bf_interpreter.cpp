@@ -4,26 +4,38 @@
 #include <cstdint>
 #include <stack>
 
+#include "bf_cell.h"
 #include "bf_interpreter.h"
 
 using std::stack;
 
-BrainfuckInterpreter::BrainfuckInterpreter() {}
+struct BrainfuckInterpreter::RunSpecializations {
+  typedef RunFunction Result;
 
-bool BrainfuckInterpreter::init(string::const_iterator start,
-                                string::const_iterator end) {
+  template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+  static Result get() {
+    return &BrainfuckInterpreter::run_cells<CellType, kEofPolicy>;
+  }
+};
+
+BrainfuckInterpreter::BrainfuckInterpreter(int cell_bits,
+                                           BrainfuckEofPolicy eof_policy) :
+    run_cells_(select_cell_specialization<RunSpecializations>(
+        cell_bits, eof_policy)) {}
+
+bool BrainfuckInterpreter::init(const char* start, const char* end) {
   start_ = start;
   end_ = end;
 
   // Build the mapping from the position of the start of a block (i.e. "]") to
   // the character *after* the end of the block.
-  stack<string::const_iterator> block_starts;
-  for (string::const_iterator it = start; it != end; ++it) {
+  stack<const char*> block_starts;
+  for (const char* it = start; it != end; ++it) {
     if (*it == '[') {
       block_starts.push(it);
     } else if (*it == ']') {
       if (block_starts.size() != 0) {
-        const string::const_iterator &loop_start = block_starts.top();
+        const char* loop_start = block_starts.top();
         loop_start_to_after_end_[loop_start] = it+1;
         block_starts.pop();
       }
@@ -40,45 +52,46 @@ bool BrainfuckInterpreter::init(string::const_iterator start,
   return true;
 }
 
-void* BrainfuckInterpreter::run(BrainfuckReader reader,
-                                void* reader_arg,
-                                BrainfuckWriter writer,
-                                void* writer_arg,
-                                void* memory) {
-  uint8_t* byte_memory = reinterpret_cast<uint8_t *>(memory);
+template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+void* BrainfuckInterpreter::run_cells(BrainfuckReader reader,
+                                      void* reader_arg,
+                                      BrainfuckWriter writer,
+                                      void* writer_arg,
+                                      void* memory) {
+  CellType* cell_memory = reinterpret_cast<CellType *>(memory);
   // When processing a "[", push the position of that command onto a stack so
   // that we can quickly return to the start of the block when then "]" is
   // interpreted.
-  stack<string::const_iterator> return_stack;
+  stack<const char*> return_stack;
 
-  for (string::const_iterator it = start_; it != end_;) {
+  for (const char* it = start_; it != end_;) {
     switch (*it) {
       case '<':
-        --byte_memory;
+        --cell_memory;
          ++it;
         break;
       case '>':
-        ++byte_memory;
+        ++cell_memory;
          ++it;
         break;
       case '-':
-        *byte_memory -= 1;
+        *cell_memory -= 1;
          ++it;
         break;
       case '+':
-        *byte_memory += 1;
+        *cell_memory += 1;
          ++it;
         break;
       case ',':
-        *byte_memory = reader(reader_arg);
+        read_cell<CellType, kEofPolicy>(reader, reader_arg, cell_memory);
          ++it;
         break;
       case '.':
-        writer(writer_arg, *byte_memory);
+        writer(writer_arg, *cell_memory);
          ++it;
         break;
       case '[':
-        if (*byte_memory) {
+        if (*cell_memory) {
           return_stack.push(it);
            ++it;
         } else {
@@ -98,5 +111,13 @@ void* BrainfuckInterpreter::run(BrainfuckReader reader,
         break;
     }
   }
-  return byte_memory;
+  return cell_memory;
+}
+
+void* BrainfuckInterpreter::run(BrainfuckReader reader,
+                                void* reader_arg,
+                                BrainfuckWriter writer,
+                                void* writer_arg,
+                                void* memory) {
+  return (this->*run_cells_)(reader, reader_arg, writer, writer_arg, memory);
 }
@@ -17,9 +17,9 @@ using std::string;
 
 class BrainfuckInterpreter : public BrainfuckRunner {
  public:
-  BrainfuckInterpreter();
-  virtual bool init(string::const_iterator start,
-                    string::const_iterator end);
+  // cell_bits must be 8, 16 or 32.
+  BrainfuckInterpreter(int cell_bits, BrainfuckEofPolicy eof_policy);
+  virtual bool init(const char* start, const char* end);
   virtual void* run(BrainfuckReader reader,
                     void* reader_arg,
                     BrainfuckWriter writer,
@@ -27,15 +27,32 @@ class BrainfuckInterpreter : public BrainfuckRunner {
                     void* memory);
 
  private:
-  string::const_iterator start_;
-  string::const_iterator end_;
+  typedef void* (BrainfuckInterpreter::*RunFunction)(BrainfuckReader reader,
+                                                     void* reader_arg,
+                                                     BrainfuckWriter writer,
+                                                     void* writer_arg,
+                                                     void* memory);
+  struct RunSpecializations;
+
+  template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+  void* run_cells(BrainfuckReader reader,
+                  void* reader_arg,
+                  BrainfuckWriter writer,
+                  void* writer_arg,
+                  void* memory);
+
+  // Interprets the source with the cell type and EOF policy chosen by the
+  // constructor (see select_cell_specialization).
+  const RunFunction run_cells_;
+  const char* start_;
+  const char* end_;
 
   // Maps the position of a Brainfuck block start to the token after the end of
   // the block e.g.
   // ,[..,]
   //  ^    ^
   //  x => y
-  map<string::const_iterator, string::const_iterator> loop_start_to_after_end_;
+  map<const char*, const char*> loop_start_to_after_end_;
 };
 
 #endif  // BF_INTERPRETER_H_
@@ -0,0 +1,109 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+
+#include <stdio.h>
+
+#include <map>
+#include <stack>
+
+#include "bf_ir.h"
+
+using std::map;
+using std::stack;
+
+// Appends the pending changes (using offsets relative to the datapointer
+// location at the start of the run) to ops. Resets the datapointer offset and
+// offset map.
+static void flush_offset_table(map<int32_t, int32_t>* offset_to_change,
+                               int32_t* offset,
+                               const char* run_start,
+                               vector<BrainfuckOp>* ops) {
+  for (auto it = offset_to_change->begin();
+       it != offset_to_change->end();
+       ++it) {
+    if (it->second == 0) {
+      continue;
+    }
+    BrainfuckOp add(kAdd, run_start);
+    add.offset = it->first;
+    add.value = it->second;
+    ops->push_back(add);
+  }
+
+  if (*offset != 0) {
+    BrainfuckOp move(kMove, run_start);
+    move.offset = *offset;
+    ops->push_back(move);
+    *offset = 0;
+  }
+  offset_to_change->clear();
+}
+
+bool parse_brainfuck(const char* start,
+                     const char* end,
+                     vector<BrainfuckOp>* ops) {
+  int32_t offset = 0;
+  // Maps offset relative to the datapointer into the amount to change it.
+  map<int32_t, int32_t> offset_to_change;
+  const char* run_start = start;
+  // The indexes of the kLoopStart ops that have not yet been matched.
+  stack<size_t> loop_starts;
+
+  for (const char* it = start; it != end; ++it) {
+    switch (*it) {
+      case '<':
+      case '>':
+      case '-':
+      case '+':
+        if (offset_to_change.empty() && offset == 0) {
+          run_start = it;
+        }
+        if (*it == '<') {
+          --offset;
+        } else if (*it == '>') {
+          ++offset;
+        } else if (*it == '-') {
+          offset_to_change[offset] -= 1;
+        } else {
+          offset_to_change[offset] += 1;
+        }
+        break;
+      case ',':
+        flush_offset_table(&offset_to_change, &offset, run_start, ops);
+        ops->push_back(BrainfuckOp(kRead, it));
+        break;
+      case '.':
+        flush_offset_table(&offset_to_change, &offset, run_start, ops);
+        ops->push_back(BrainfuckOp(kWrite, it));
+        break;
+      case '[':
+        flush_offset_table(&offset_to_change, &offset, run_start, ops);
+        loop_starts.push(ops->size());
+        ops->push_back(BrainfuckOp(kLoopStart, it));
+        break;
+      case ']':
+        if (loop_starts.empty()) {
+          break;
+        }
+        flush_offset_table(&offset_to_change, &offset, run_start, ops);
+        {
+          BrainfuckOp loop_end(kLoopEnd, it);
+          loop_end.match = loop_starts.top();
+          (*ops)[loop_starts.top()].match = ops->size();
+          ops->push_back(loop_end);
+          loop_starts.pop();
+        }
+        break;
+    }
+  }
+  flush_offset_table(&offset_to_change, &offset, run_start, ops);
+
+  if (!loop_starts.empty()) {
+    fprintf(
+        stderr,
+        "Unable to find loop end in block starting with: %s\n",
+        string((*ops)[loop_starts.top()].source, end).c_str());
+    return false;
+  }
+  return true;
+}
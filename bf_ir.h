@@ -0,0 +1,66 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+//
+// A simple intermediate representation (IR) for Brainfuck code. Runs of
+// "+", "-", "<" and ">" are folded into a table of changes relative to the
+// current data pointer followed by a single data pointer move, so that e.g.
+// "<<<++>>>--->++><>>+>>>" becomes:
+//
+// add  [ptr-3],2
+// add  [ptr],-3
+// add  [ptr+1],2
+// add  [ptr+2],1
+// move ptr,5
+
+#ifndef BF_IR_H_
+#define BF_IR_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+enum BrainfuckOpcode {
+  kAdd,        // *(ptr + offset) += value
+  kSet,        // *(ptr + offset) = value (only produced by optimization)
+  kMove,       // ptr += offset
+  kRead,       // *ptr = read()
+  kWrite,      // write(*ptr)
+  kLoopStart,  // if (*ptr == 0) goto <op after match>
+  kLoopEnd,    // if (*ptr != 0) goto <op after match>
+  kGuard,      // if ((*ptr != 0) != value) leave with side exit match
+               // (only produced by trace recording)
+  kGuardEqual,  // if (*ptr != value) leave with side exit match (only
+                // produced by loop specialization)
+};
+
+struct BrainfuckOp {
+  BrainfuckOp(BrainfuckOpcode opcode, const char* source) :
+      opcode(opcode), offset(0), value(0), match(0), source(source) {}
+
+  BrainfuckOpcode opcode;
+  // The offset, relative to the data pointer, used by kAdd, kSet and kMove.
+  int32_t offset;
+  // The amount added to the cell by kAdd, the value stored by kSet, the value
+  // expected by kGuardEqual or, for kGuard, whether the cell is expected to be
+  // non-zero.
+  int32_t value;
+  // The index of the matching kLoopEnd for kLoopStart and vice versa. For
+  // kGuard and kGuardEqual, and for kWrite in a trace, the side exit taken if
+  // the guard fails or the write fails.
+  size_t match;
+  // The position of the first Brainfuck command that produced this op.
+  const char* source;
+};
+
+// Converts the Brainfuck commands in [start, end) into IR, which is appended
+// to ops.
+// Unmatched "]" commands are ignored. Returns false if there is a "[" without
+// a matching "]".
+bool parse_brainfuck(const char* start,
+                     const char* end,
+                     vector<BrainfuckOp>* ops);
+
+#endif  // BF_IR_H_
@@ -1,9 +1,13 @@
 // Copyright 2014 Brian Quinlan
 // See "LICENSE" file for details.
 
+#include <string.h>
+
 #include <cstdint>
 #include <stack>
 
+#include "bf_cell.h"
+#include "bf_ir.h"
 #include "bf_jit.h"
 
 using std::stack;
@@ -11,24 +15,93 @@ using std::stack;
 // The total number of times that a loop condition (e.g. "[") must be evaluated
 // before the loop is compiled.
 const int kLoopCompilationThreshold = 20;
+// The maximum number of Brainfuck commands in a trace. Loops with longer
+// iterations are compiled as a whole.
+const size_t kMaxTraceLength = 1000;
+// A trace is discarded, and the loop compiled as a whole, if more than half of
+// the runs of the trace end in a side exit (after at least this many runs).
+const uint64_t kMinTraceRuns = 100;
+// The trace side exit taken when the condition of the traced loop is false.
+const uint64_t kLoopConditionExit = 0;
+// The number of consecutive times that a counting loop must be entered with
+// the same counter value before it is specialized for that value.
+const uint64_t kSpecializationThreshold = 8;
+// The maximum number of iterations, and unrolled ops, in a specialized loop.
+const uint64_t kMaxSpecializedIterations = 1024;
+const size_t kMaxSpecializedOps = 8 * 1024;
+// The number of times that the guard of a specialized loop may fail before
+// the specialization is discarded.
+const uint64_t kMaxDeoptimizations = 8;
+// The maximum number of times that a loop may be specialized.
+const int kMaxSpecializations = 4;
+// The side exits of a specialized loop.
+const uint64_t kSpecializationCompletedExit = 0;
+const uint64_t kSpecializationDeoptimizedExit = 1;
+
+// Returns the amount that each iteration of the loop with the body [start,
+// end) adds to the loop's condition cell if the loop is a counting loop (see
+// BrainfuckJIT::Loop::counter_step) or 0 otherwise.
+static int32_t find_counter_step(const char* start,
+                                 const char* end) {
+  vector<BrainfuckOp> ops;
+  parse_brainfuck(start, end, &ops);
+
+  int32_t position = 0;
+  int32_t step = 0;
+  for (auto op = ops.begin(); op != ops.end(); ++op) {
+    switch (op->opcode) {
+      case kAdd:
+        if (position + op->offset == 0) {
+          step += op->value;
+        }
+        break;
+      case kMove:
+        position += op->offset;
+        break;
+      default:
+        return 0;
+    }
+  }
+  return position == 0 ? step : 0;
+}
+
+struct BrainfuckJIT::RunSpecializations {
+  typedef RunFunction Result;
+
+  template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+  static Result get() {
+    return &BrainfuckJIT::run_cells<CellType, kEofPolicy>;
+  }
+};
 
-BrainfuckJIT::BrainfuckJIT() {}
+BrainfuckJIT::BrainfuckJIT(int cell_bits, BrainfuckEofPolicy eof_policy) :
+    cell_bits_(cell_bits),
+    eof_policy_(eof_policy),
+    run_cells_(select_cell_specialization<RunSpecializations>(
+        cell_bits, eof_policy)) {}
 
-bool BrainfuckJIT::init(string::const_iterator start,
-                        string::const_iterator end) {
+bool BrainfuckJIT::init(const char* start, const char* end) {
   start_ = start;
   end_ = end;
 
   // Build the mapping from the position of the start of a block (i.e. "]") to
   // a Loop struct.
-  stack<string::const_iterator> block_starts;
-  for (string::const_iterator it = start; it != end; ++it) {
+  stack<const char*> block_starts;
+  // The position of the most recent "[".
+  const char* last_block_start = end;
+  for (const char* it = start; it != end; ++it) {
     if (*it == '[') {
       block_starts.push(it);
+      last_block_start = it;
     } else if (*it == ']') {
       if (block_starts.size() != 0) {
-        const string::const_iterator &loop_start = block_starts.top();
-        loop_start_to_loop_[loop_start] = Loop(it+1);
+        const char* loop_start = block_starts.top();
+        Loop loop(it+1);
+        if (loop_start == last_block_start) {
+          // The loop does not contain any other loops.
+          loop.counter_step = find_counter_step(loop_start + 1, it);
+        }
+        loop_start_to_loop_[loop_start] = loop;
         block_starts.pop();
       }
     }
@@ -44,73 +117,347 @@ bool BrainfuckJIT::init(string::const_iterator start,
   return true;
 }
 
-void* BrainfuckJIT::run(BrainfuckReader reader,
-                        void* reader_arg,
-                        BrainfuckWriter writer,
-                        void* writer_arg,
-                        void* memory) {
-  uint8_t* byte_memory = reinterpret_cast<uint8_t *>(memory);
+// Returns a version of the counting loop starting at loop_start that is
+// specialized for the given value of its condition cell, or NULL if the loop
+// would run for too many iterations with that value. The specialized version
+// guards against the condition cell having a different value and then
+// contains the loop body once for each iteration. Knowing the counter value
+// allows the optimizer to fold the counter updates and combine the changes to
+// each other cell.
+shared_ptr<BrainfuckJIT::Specialization> BrainfuckJIT::specialize_loop(
+    const char* loop_start,
+    const Loop& loop,
+    uint32_t entry_value) {
+  const uint32_t cell_mask =
+      cell_bits_ == 32 ? 0xffffffff : (1u << cell_bits_) - 1;
+  uint64_t iterations = 0;
+  for (uint32_t value = entry_value; value != 0;
+       value = (value + loop.counter_step) & cell_mask) {
+    if (++iterations > kMaxSpecializedIterations) {
+      return nullptr;
+    }
+  }
+
+  vector<BrainfuckOp> body;
+  parse_brainfuck(loop_start + 1, loop.after_end - 1, &body);
+  if (iterations * body.size() > kMaxSpecializedOps) {
+    return nullptr;
+  }
+
+  vector<BrainfuckOp> ops;
+  BrainfuckOp guard(kGuardEqual, loop_start);
+  guard.value = entry_value;
+  guard.match = kSpecializationDeoptimizedExit;
+  ops.push_back(guard);
+  for (uint64_t i = 0; i < iterations; ++i) {
+    ops.insert(ops.end(), body.begin(), body.end());
+  }
+
+  shared_ptr<Specialization> specialization(new Specialization());
+  specialization->compiled.reset(
+      new BrainfuckCompileAndGo(cell_bits_, eof_policy_, false, false));
+  if (!specialization->compiled->init_trace(ops, false,
+                                            kSpecializationCompletedExit)) {
+    return nullptr;
+  }
+  return specialization;
+}
+
+// Appends the ops for the Brainfuck commands [start, end), which must not
+// include "[" or "]", to a trace. loop_starts are the loops that have been
+// entered since the start of the trace.
+void BrainfuckJIT::append_trace_segment(
+    const char* start,
+    const char* end,
+    const vector<const char*>& loop_starts,
+    Trace* trace,
+    vector<BrainfuckOp>* ops) {
+  size_t first_op = ops->size();
+  parse_brainfuck(start, end, ops);
+  for (size_t i = first_op; i < ops->size(); ++i) {
+    if ((*ops)[i].opcode == kWrite) {
+      // If the write fails then continue interpreting after the ".".
+      TraceExit exit;
+      exit.resume = (*ops)[i].source + 1;
+      exit.loop_starts = loop_starts;
+      (*ops)[i].match = trace->exits.size();
+      trace->exits.push_back(exit);
+    }
+  }
+}
+
+// Interprets one iteration of the loop starting at *position, whose condition
+// must be true, while recording the path taken as trace ops. Returns true if
+// the iteration was completed (so *position is the loop start again) or false
+// if it was too long to trace (so *position is where recording stopped).
+template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+bool BrainfuckJIT::record_trace(const char** position,
+                                CellType** cell,
+                                stack<const char*>* return_stack,
+                                BrainfuckReader reader,
+                                void* reader_arg,
+                                BrainfuckWriter writer,
+                                void* writer_arg,
+                                Trace* trace,
+                                vector<BrainfuckOp>* ops) {
+  const char* const trace_start = *position;
+  const char* it = *position;
+  CellType* cell_memory = *cell;
+  // The loops entered since the start of the trace.
+  vector<const char*> loop_starts;
+  // The start of the commands that have not yet been added to ops.
+  const char* segment_start = it;
+  bool recorded = false;
+
+  // The number of Brainfuck commands recorded. Other characters are skipped
+  // without being counted.
+  size_t length = 0;
+  while (!recorded && length < kMaxTraceLength) {
+    const bool command = memchr("+-<>,.[]", *it, 8) != NULL;
+    switch (*it) {
+      case '<':
+        --cell_memory;
+        ++it;
+        break;
+      case '>':
+        ++cell_memory;
+        ++it;
+        break;
+      case '-':
+        *cell_memory -= 1;
+        ++it;
+        break;
+      case '+':
+        *cell_memory += 1;
+        ++it;
+        break;
+      case ',':
+        read_cell<CellType, kEofPolicy>(reader, reader_arg, cell_memory);
+        ++it;
+        break;
+      case '.':
+        writer(writer_arg, *cell_memory);
+        ++it;
+        break;
+      case '[':
+        if (it == trace_start && length != 0) {
+          recorded = true;
+          break;
+        }
+        append_trace_segment(segment_start, it, loop_starts, trace, ops);
+        {
+          BrainfuckOp guard(kGuard, it);
+          guard.value = *cell_memory != 0;
+          guard.match = trace->exits.size();
+          ops->push_back(guard);
+
+          // If the guard fails then take the other branch.
+          TraceExit exit;
+          exit.loop_starts = loop_starts;
+          if (*cell_memory) {
+            exit.resume = loop_start_to_loop_[it].after_end;
+            loop_starts.push_back(it);
+            return_stack->push(it);
+            ++it;
+          } else {
+            exit.resume = it + 1;
+            exit.loop_starts.push_back(it);
+            it = loop_start_to_loop_[it].after_end;
+          }
+          trace->exits.push_back(exit);
+        }
+        segment_start = it;
+        break;
+      case ']':
+        append_trace_segment(segment_start, it, loop_starts, trace, ops);
+        it = return_stack->top();
+        return_stack->pop();
+        loop_starts.pop_back();
+        segment_start = it;
+        break;
+      default:
+        ++it;
+        break;
+    }
+    if (command) {
+      ++length;
+    }
+  }
+
+  *position = it;
+  *cell = cell_memory;
+  return recorded;
+}
+
+template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+void* BrainfuckJIT::run_cells(BrainfuckReader reader,
+                              void* reader_arg,
+                              BrainfuckWriter writer,
+                              void* writer_arg,
+                              void* memory) {
+  CellType* cell_memory = reinterpret_cast<CellType *>(memory);
   // When processing a "[", push the position of that command onto a stack so
   // that we can quickly return to the start of the block when then "]" is
   // interpreted.
-  stack<string::const_iterator> return_stack;
+  stack<const char*> return_stack;
+  // True if the current command was reached by jumping back from a "]".
+  bool back_edge = false;
 
-  for (string::const_iterator it = start_; it != end_;) {
+  for (const char* it = start_; it != end_;) {
     switch (*it) {
       case '<':
-        --byte_memory;
+        --cell_memory;
          ++it;
         break;
       case '>':
-        ++byte_memory;
+        ++cell_memory;
          ++it;
         break;
       case '-':
-        *byte_memory -= 1;
+        *cell_memory -= 1;
          ++it;
         break;
       case '+':
-        *byte_memory += 1;
+        *cell_memory += 1;
          ++it;
         break;
       case ',':
-        *byte_memory = reader(reader_arg);
+        read_cell<CellType, kEofPolicy>(reader, reader_arg, cell_memory);
          ++it;
         break;
       case '.':
-        writer(writer_arg, *byte_memory);
+        writer(writer_arg, *cell_memory);
          ++it;
         break;
       case '[':
         {
           Loop &loop = loop_start_to_loop_[it];
+          const bool entry = !back_edge;
+          back_edge = false;
 
-          if (loop.compiled == nullptr &&
-              loop.condition_evaluation_count > kLoopCompilationThreshold) {
-            shared_ptr<BrainfuckCompileAndGo> compiled(
-              new BrainfuckCompileAndGo());
-            string::const_iterator compilation_end(loop.after_end);
-
-            if (!compiled->init(it, compilation_end)) {
-              fprintf(stderr,
-                      "Unable to compile code: %s\n",
-                      string(it, compilation_end).c_str());
+          if (entry && loop.counter_step != 0) {
+            const uint32_t value = *cell_memory;
+            if (loop.specialization == nullptr &&
+                loop.specialization_count < kMaxSpecializations) {
+              if (value == loop.entry_value) {
+                ++loop.entry_value_count;
+              } else {
+                loop.entry_value = value;
+                loop.entry_value_count = 1;
+              }
+              if (loop.entry_value_count == kSpecializationThreshold) {
+                loop.specialization = specialize_loop(it, loop, value);
+                ++loop.specialization_count;
+              }
+            }
+
+            if (loop.specialization) {
+              BrainfuckTraceResult result =
+                  loop.specialization->compiled->run_trace(
+                      reader, reader_arg, writer, writer_arg, cell_memory);
+              cell_memory = reinterpret_cast<CellType *>(result.memory);
+              if (result.exit == kSpecializationCompletedExit) {
+                it = loop.after_end;
+                break;
+              }
+
+              // Deoptimize i.e. continue without the specialization.
+              if (++loop.specialization->deoptimization_count >
+                  kMaxDeoptimizations) {
+                loop.specialization.reset();
+                loop.entry_value_count = 0;
+              }
+            }
+          }
+
+          if (loop.trace) {
+            Trace* trace = loop.trace.get();
+            BrainfuckTraceResult result = trace->compiled->run_trace(
+                reader, reader_arg, writer, writer_arg, cell_memory);
+            cell_memory = reinterpret_cast<CellType *>(result.memory);
+            const TraceExit& exit = trace->exits[result.exit];
+            for (auto loop_start = exit.loop_starts.begin();
+                 loop_start != exit.loop_starts.end();
+                 ++loop_start) {
+              return_stack.push(*loop_start);
+            }
+            it = exit.resume;
+
+            ++trace->run_count;
+            if (result.exit != kLoopConditionExit &&
+                ++trace->side_exit_count * 2 > trace->run_count &&
+                trace->run_count >= kMinTraceRuns) {
+              // The path through the loop is too irregular to trace.
+              loop.trace.reset();
+              loop.trace_failed = true;
+            }
+            break;
+          }
+
+          if (loop.compiled == nullptr && !loop.trace_failed &&
+              loop.condition_evaluation_count > kLoopCompilationThreshold &&
+              *cell_memory) {
+            shared_ptr<Trace> trace(new Trace());
+            vector<BrainfuckOp> trace_ops;
+            if (record_trace<CellType, kEofPolicy>(&it, &cell_memory,
+                                                   &return_stack,
+                                                   reader, reader_arg,
+                                                   writer, writer_arg,
+                                                   trace.get(), &trace_ops)) {
+              // Recording stopped on the loop's "[" after one iteration.
+              back_edge = true;
+              trace->compiled.reset(
+                  new BrainfuckCompileAndGo(cell_bits_, eof_policy_, false,
+                                            false));
+              if (trace->compiled->init_trace(trace_ops, true, 0)) {
+                loop.trace = trace;
+              } else {
+                loop.trace_failed = true;
+              }
             } else {
-              loop.compiled = compiled;
+              loop.trace_failed = true;
+            }
+            break;
+          }
+
+          if (loop.compiled == nullptr && loop.trace_failed &&
+              loop.condition_evaluation_count > kLoopCompilationThreshold) {
+            const char* compilation_end(loop.after_end);
+            // Loops with the same commands share their compiled code.
+            string commands;
+            for (const char* c = it; c != compilation_end; ++c) {
+              if (memchr("+-<>,.[]", *c, 8) != NULL) {
+                commands += *c;
+              }
             }
+
+            shared_ptr<BrainfuckCompileAndGo>& compiled =
+                compiled_loops_[commands];
+            if (compiled == nullptr) {
+              compiled.reset(
+                new BrainfuckCompileAndGo(cell_bits_, eof_policy_, false,
+                                          false));
+              if (!compiled->init(it, compilation_end)) {
+                fprintf(stderr,
+                        "Unable to compile code: %s\n",
+                        string(it, compilation_end).c_str());
+                compiled.reset();
+              }
+            }
+            loop.compiled = compiled;
           }
 
           if (loop.compiled) {
-            byte_memory = reinterpret_cast<uint8_t *>(
+            cell_memory = reinterpret_cast<CellType *>(
                 loop.compiled->run(reader,
                                    reader_arg,
                                    writer,
                                    writer_arg,
-                                   byte_memory));
+                                   cell_memory));
             it = loop_start_to_loop_[it].after_end;
           } else {
             ++loop.condition_evaluation_count;
-            if (*byte_memory) {
+            if (*cell_memory) {
               return_stack.push(it);
               ++it;
             } else {
@@ -123,6 +470,7 @@ void* BrainfuckJIT::run(BrainfuckReader reader,
         if (return_stack.size() != 0) {
           it = return_stack.top();
           return_stack.pop();
+          back_edge = true;
         } else {
           ++it;
         }
@@ -132,5 +480,13 @@ void* BrainfuckJIT::run(BrainfuckReader reader,
         break;
     }
   }
-  return byte_memory;
+  return cell_memory;
+}
+
+void* BrainfuckJIT::run(BrainfuckReader reader,
+                        void* reader_arg,
+                        BrainfuckWriter writer,
+                        void* writer_arg,
+                        void* memory) {
+  return (this->*run_cells_)(reader, reader_arg, writer, writer_arg, memory);
 }
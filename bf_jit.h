@@ -4,26 +4,42 @@
 // Implements a BrainfuckRunner that interprets the Brainfuck source one command
 // at a time but will use BrainfuckCompileAndGo to execute loops that are
 // run frequently.
+//
+// When a loop becomes hot, the path taken through one iteration of it is
+// recorded, including the decisions made at each inner "[", and compiled into
+// linear code (a trace) that repeats until execution leaves that path. If the
+// path is too long to record, or execution often leaves it, then the whole
+// loop is compiled instead.
+//
+// Simple counting loops that are repeatedly entered with the same counter
+// value are compiled into a version specialized for that value, in which the
+// loop is completely unrolled. The specialized version starts with a guard
+// that checks the counter value. If the guard fails then execution continues
+// in the interpreter at the start of the loop.
 
 #ifndef BF_JIT_H_
 #define BF_JIT_H_
 
 #include <map>
+#include <stack>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include "bf_runner.h"
 #include "bf_compile_and_go.h"
 
 using std::map;
+using std::stack;
 using std::string;
 using std::shared_ptr;
+using std::vector;
 
 class BrainfuckJIT : public BrainfuckRunner {
  public:
-  BrainfuckJIT();
-  virtual bool init(string::const_iterator start,
-                    string::const_iterator end);
+  // cell_bits must be 8, 16 or 32.
+  BrainfuckJIT(int cell_bits, BrainfuckEofPolicy eof_policy);
+  virtual bool init(const char* start, const char* end);
   virtual void* run(BrainfuckReader reader,
                     void* reader_arg,
                     BrainfuckWriter writer,
@@ -31,13 +47,49 @@ class BrainfuckJIT : public BrainfuckRunner {
                     void* memory);
 
  private:
+  // Where the interpreter continues after leaving a trace.
+  struct TraceExit {
+    // The position of the next Brainfuck command to interpret.
+    const char* resume;
+    // The loop starts to push onto the return stack, in order, before
+    // resuming.
+    vector<const char*> loop_starts;
+  };
+
+  // A compiled path through one iteration of a loop.
+  struct Trace {
+    Trace() : run_count(0), side_exit_count(0) { }
+
+    shared_ptr<BrainfuckCompileAndGo> compiled;
+    // Indexed by the side exit returned by BrainfuckCompileAndGo::run_trace.
+    vector<TraceExit> exits;
+    // The number of times that the trace has been run.
+    uint64_t run_count;
+    // The number of times that the trace was left other than by the loop
+    // condition becoming false.
+    uint64_t side_exit_count;
+  };
+
+  // A version of a loop that is specialized for a particular counter value.
+  struct Specialization {
+    Specialization() : deoptimization_count(0) { }
+
+    shared_ptr<BrainfuckCompileAndGo> compiled;
+    // The number of times that the guard of the specialization failed.
+    uint64_t deoptimization_count;
+  };
+
   struct Loop {
-    Loop() : condition_evaluation_count(0) { }
-    explicit Loop(string::const_iterator after) :
-        after_end(after),  condition_evaluation_count(0) { }
+    Loop() : condition_evaluation_count(0), trace_failed(false),
+             counter_step(0), entry_value(0), entry_value_count(0),
+             specialization_count(0) { }
+    explicit Loop(const char* after) :
+        after_end(after),  condition_evaluation_count(0),
+        trace_failed(false), counter_step(0), entry_value(0),
+        entry_value_count(0), specialization_count(0) { }
 
     // The position of the Brainfuck token after the end of the loop.
-    string::const_iterator after_end;
+    const char* after_end;
     // The number of types that the loop condition (e.g. "[") has been
     // evaluated. Note that the count will not be updated after the loop has
     // been JITed.
@@ -45,16 +97,75 @@ class BrainfuckJIT : public BrainfuckRunner {
     // The compiled code that represents the loop. Will be NULL until the loop
     // is JITed.
     shared_ptr<BrainfuckCompileAndGo> compiled;
+    // The trace of the loop. Will be NULL until the loop is traced.
+    shared_ptr<Trace> trace;
+    // True if the loop could not be traced or its trace was discarded.
+    bool trace_failed;
+    // If the loop is a counting loop i.e. it contains no other loops or I/O,
+    // does not move the data pointer and only changes its condition cell by
+    // adding the same amount in each iteration, then that amount. 0
+    // otherwise.
+    int32_t counter_step;
+    // The value of the condition cell when the loop was last entered and the
+    // number of consecutive entries with that value.
+    uint32_t entry_value;
+    uint64_t entry_value_count;
+    // The version of the loop specialized for entry_value, if any.
+    shared_ptr<Specialization> specialization;
+    // The number of times that the loop has been specialized.
+    int specialization_count;
   };
 
-  string::const_iterator start_;
-  string::const_iterator end_;
+  typedef void* (BrainfuckJIT::*RunFunction)(BrainfuckReader reader,
+                                             void* reader_arg,
+                                             BrainfuckWriter writer,
+                                             void* writer_arg,
+                                             void* memory);
+  struct RunSpecializations;
+
+  template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+  void* run_cells(BrainfuckReader reader,
+                  void* reader_arg,
+                  BrainfuckWriter writer,
+                  void* writer_arg,
+                  void* memory);
+
+  template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+  bool record_trace(const char** position,
+                    CellType** cell,
+                    stack<const char*>* return_stack,
+                    BrainfuckReader reader,
+                    void* reader_arg,
+                    BrainfuckWriter writer,
+                    void* writer_arg,
+                    Trace* trace,
+                    vector<BrainfuckOp>* ops);
+  shared_ptr<Specialization> specialize_loop(const char* loop_start,
+                                             const Loop& loop,
+                                             uint32_t entry_value);
+  void append_trace_segment(const char* start,
+                            const char* end,
+                            const vector<const char*>& loop_starts,
+                            Trace* trace,
+                            vector<BrainfuckOp>* ops);
+
+  const int cell_bits_;
+  const BrainfuckEofPolicy eof_policy_;
+  // Runs and traces the program with the cell type and EOF policy chosen by
+  // the constructor (see select_cell_specialization).
+  const RunFunction run_cells_;
+  const char* start_;
+  const char* end_;
 
   // Maps the position of a Brainfuck block start to Loop e.g.
   // ,[..,]
   //  ^    ^
   //  x    y  => loop_start_to_loop_[x] = Loop(y);
-  map<string::const_iterator, Loop> loop_start_to_loop_;
+  map<const char*, Loop> loop_start_to_loop_;
+  // Maps the commands of each loop compiled as a whole (without any other
+  // characters) to its compiled code, which is shared by every loop with the
+  // same commands.
+  map<string, shared_ptr<BrainfuckCompileAndGo>> compiled_loops_;
 };
 
 #endif  // BF_JIT_H_
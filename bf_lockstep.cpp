@@ -0,0 +1,276 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+
+#include <stack>
+
+#include "bf_cell.h"
+#include "bf_lockstep.h"
+#include "bf_optimizer.h"
+
+using std::stack;
+
+// If no more than this many lanes want to repeat a loop while other lanes are
+// waiting for it to finish then the remaining iterations are run one lane at a
+// time.
+const int kScalarFallbackLanes = 4;
+
+static int count_lanes(uint32_t mask) {
+  return __builtin_popcount(mask);
+}
+
+struct BrainfuckLockstep::RunSpecializations {
+  typedef RunFunction Result;
+
+  template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+  static Result get() {
+    return &BrainfuckLockstep::run_cells<CellType, kEofPolicy>;
+  }
+};
+
+BrainfuckLockstep::BrainfuckLockstep(int cell_bits,
+                                     BrainfuckEofPolicy eof_policy) :
+    cell_bits_(cell_bits),
+    run_cells_(select_cell_specialization<RunSpecializations>(
+        cell_bits, eof_policy)) {}
+
+bool BrainfuckLockstep::init(const char* start, const char* end) {
+  ops_.clear();
+  if (!parse_brainfuck(start, end, &ops_)) {
+    return false;
+  }
+  optimize_brainfuck(cell_bits_, false, &ops_);
+  return true;
+}
+
+void BrainfuckLockstep::set_active(LaneMask active) {
+  active_ = active;
+  int first_lane = -1;
+  aligned_ = true;
+  for (int lane = 0; lane < kLanes; ++lane) {
+    if (active & (1u << lane)) {
+      active_bytes_[lane] = 0xff;
+      if (first_lane == -1) {
+        first_lane = lane;
+      } else if (rows_[lane] != rows_[first_lane]) {
+        aligned_ = false;
+      }
+    } else {
+      active_bytes_[lane] = 0;
+    }
+  }
+}
+
+// Returns the active lanes whose current cell is non-zero.
+template <typename CellType>
+BrainfuckLockstep::LaneMask BrainfuckLockstep::nonzero_lanes(
+    const CellType* memory) const {
+  LaneMask nonzero = 0;
+  if (aligned_) {
+    const CellType* row =
+        memory + rows_[__builtin_ctz(active_)] * kLanes;
+    for (int lane = 0; lane < kLanes; ++lane) {
+      nonzero |= static_cast<LaneMask>(row[lane] != 0) << lane;
+    }
+  } else {
+    for (int lane = 0; lane < kLanes; ++lane) {
+      nonzero |= static_cast<LaneMask>(
+          memory[rows_[lane] * kLanes + lane] != 0) << lane;
+    }
+  }
+  return nonzero & active_;
+}
+
+// Runs the ops between first_op and last_op (inclusive) for a single lane.
+// last_op must be the kLoopEnd of a loop whose body starts at first_op.
+template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+void BrainfuckLockstep::run_lane_scalar(int lane,
+                                        size_t first_op,
+                                        size_t last_op,
+                                        BrainfuckReader reader,
+                                        void* const reader_args[],
+                                        BrainfuckWriter writer,
+                                        void* const writer_args[],
+                                        CellType* memory) {
+  CellType* cell = memory + rows_[lane] * kLanes + lane;
+
+  for (size_t i = first_op; i <= last_op;) {
+    const BrainfuckOp& op = ops_[i];
+    switch (op.opcode) {
+      case kAdd:
+        cell[op.offset * kLanes] += op.value;
+        ++i;
+        break;
+      case kSet:
+        cell[op.offset * kLanes] = op.value;
+        ++i;
+        break;
+      case kMove:
+        cell += op.offset * kLanes;
+        ++i;
+        break;
+      case kRead:
+        read_cell<CellType, kEofPolicy>(reader, reader_args[lane], cell);
+        ++i;
+        break;
+      case kWrite:
+        writer(writer_args[lane], *cell);
+        ++i;
+        break;
+      case kLoopStart:
+        i = *cell ? i + 1 : op.match + 1;
+        break;
+      case kLoopEnd:
+        i = *cell ? op.match + 1 : i + 1;
+        break;
+      case kGuard:
+      case kGuardEqual:
+        // Only produced by the JIT.
+        ++i;
+        break;
+    }
+  }
+  rows_[lane] = (cell - lane - memory) / kLanes;
+}
+
+template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+void BrainfuckLockstep::run_cells(int lane_count,
+                                  BrainfuckReader reader,
+                                  void* const reader_args[],
+                                  BrainfuckWriter writer,
+                                  void* const writer_args[],
+                                  void* cell_memory) {
+  CellType* memory = reinterpret_cast<CellType *>(cell_memory);
+  if (lane_count <= 0) {
+    return;
+  }
+  for (int lane = 0; lane < kLanes; ++lane) {
+    rows_[lane] = 0;
+  }
+  set_active(lane_count >= kLanes ?
+             ~static_cast<LaneMask>(0) :
+             (static_cast<LaneMask>(1) << lane_count) - 1);
+
+  // When lanes enter a loop, the lanes that were active before the loop are
+  // pushed so that they can be restored when the loop is finished.
+  stack<LaneMask> enclosing_active;
+
+  for (size_t i = 0; i < ops_.size();) {
+    const BrainfuckOp& op = ops_[i];
+    switch (op.opcode) {
+      case kAdd:
+        if (aligned_) {
+          CellType* row =
+              memory + (rows_[__builtin_ctz(active_)] + op.offset) * kLanes;
+          const CellType value = op.value;
+          for (int lane = 0; lane < kLanes; ++lane) {
+            row[lane] += value & static_cast<CellType>(
+                static_cast<int8_t>(active_bytes_[lane]));
+          }
+        } else {
+          for (int lane = 0; lane < kLanes; ++lane) {
+            if (active_ & (1u << lane)) {
+              memory[(rows_[lane] + op.offset) * kLanes + lane] += op.value;
+            }
+          }
+        }
+        ++i;
+        break;
+      case kSet:
+        if (aligned_) {
+          CellType* row =
+              memory + (rows_[__builtin_ctz(active_)] + op.offset) * kLanes;
+          const CellType value = op.value;
+          for (int lane = 0; lane < kLanes; ++lane) {
+            CellType mask = static_cast<CellType>(
+                static_cast<int8_t>(active_bytes_[lane]));
+            row[lane] = (row[lane] & ~mask) | (value & mask);
+          }
+        } else {
+          for (int lane = 0; lane < kLanes; ++lane) {
+            if (active_ & (1u << lane)) {
+              memory[(rows_[lane] + op.offset) * kLanes + lane] = op.value;
+            }
+          }
+        }
+        ++i;
+        break;
+      case kMove:
+        for (int lane = 0; lane < kLanes; ++lane) {
+          rows_[lane] += active_bytes_[lane] ? op.offset : 0;
+        }
+        ++i;
+        break;
+      case kRead:
+        for (int lane = 0; lane < kLanes; ++lane) {
+          if (active_ & (1u << lane)) {
+            CellType* cell = &memory[rows_[lane] * kLanes + lane];
+            read_cell<CellType, kEofPolicy>(reader, reader_args[lane], cell);
+          }
+        }
+        ++i;
+        break;
+      case kWrite:
+        for (int lane = 0; lane < kLanes; ++lane) {
+          if (active_ & (1u << lane)) {
+            writer(writer_args[lane], memory[rows_[lane] * kLanes + lane]);
+          }
+        }
+        ++i;
+        break;
+      case kLoopStart:
+        {
+          LaneMask entering = nonzero_lanes(memory);
+          if (entering == 0) {
+            i = op.match + 1;
+          } else {
+            enclosing_active.push(active_);
+            set_active(entering);
+            ++i;
+          }
+        }
+        break;
+      case kLoopEnd:
+        {
+          LaneMask repeating = nonzero_lanes(memory);
+          if (repeating != 0 &&
+              repeating != enclosing_active.top() &&
+              count_lanes(repeating) <= kScalarFallbackLanes) {
+            for (int lane = 0; lane < kLanes; ++lane) {
+              if (repeating & (1u << lane)) {
+                run_lane_scalar<CellType, kEofPolicy>(lane, op.match + 1, i,
+                                                      reader, reader_args,
+                                                      writer, writer_args,
+                                                      memory);
+              }
+            }
+            repeating = 0;
+          }
+
+          if (repeating != 0) {
+            set_active(repeating);
+            i = op.match + 1;
+          } else {
+            set_active(enclosing_active.top());
+            enclosing_active.pop();
+            ++i;
+          }
+        }
+        break;
+      case kGuard:
+      case kGuardEqual:
+        // Only produced by the JIT.
+        ++i;
+        break;
+    }
+  }
+}
+
+void BrainfuckLockstep::run(int lane_count,
+                            BrainfuckReader reader,
+                            void* const reader_args[],
+                            BrainfuckWriter writer,
+                            void* const writer_args[],
+                            void* memory) {
+  (this->*run_cells_)(lane_count, reader, reader_args, writer, writer_args,
+                      memory);
+}
@@ -0,0 +1,103 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+//
+// Executes many independent instances (lanes) of the same Brainfuck program in
+// lockstep. The lanes' memory is stored as a structure-of-arrays i.e. cell "n"
+// of every lane is stored in one contiguous row so that each "+", "-" applies
+// to all lanes at once, using vector instructions when the compiler
+// vectorizes the per-row loops.
+//
+// When lanes disagree at a "[" or "]", the lanes that do not take the branch
+// are masked out until the other lanes reach the same point in the program.
+// If only a few lanes keep iterating a loop, those lanes finish the loop one at
+// a time rather than dragging the masked lanes along.
+
+#ifndef BF_LOCKSTEP_H_
+#define BF_LOCKSTEP_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bf_ir.h"
+#include "bf_runner.h"
+
+using std::string;
+using std::vector;
+
+class BrainfuckLockstep {
+ public:
+  // The maximum number of lanes that can be run at once.
+  static const int kLanes = 32;
+
+  // cell_bits must be 8, 16 or 32.
+  BrainfuckLockstep(int cell_bits, BrainfuckEofPolicy eof_policy);
+
+  // Initialize the runner using the Brainfuck opcodes in [start, end), which
+  // must remain valid while the runner is used. Returns false if the
+  // Brainfuck code is invalid.
+  bool init(const char* start, const char* end);
+
+  // Runs the Brainfuck code given in "init" once for each of the first
+  // "lane_count" lanes. When "," is evaluated in lane i, call
+  // reader(reader_args[i]). When "." is evaluated in lane i, call
+  // writer(writer_args[i], <char to write>). "memory" is an array of cells,
+  // of the width given in the constructor, where cell n of lane i is at
+  // memory[n * kLanes + i].
+  void run(int lane_count,
+           BrainfuckReader reader,
+           void* const reader_args[],
+           BrainfuckWriter writer,
+           void* const writer_args[],
+           void* memory);
+
+ private:
+  // A bit mask with one bit per lane.
+  typedef uint32_t LaneMask;
+  typedef void (BrainfuckLockstep::*RunFunction)(int lane_count,
+                                                 BrainfuckReader reader,
+                                                 void* const reader_args[],
+                                                 BrainfuckWriter writer,
+                                                 void* const writer_args[],
+                                                 void* memory);
+  struct RunSpecializations;
+
+  void set_active(LaneMask active);
+  template <typename CellType>
+  LaneMask nonzero_lanes(const CellType* memory) const;
+  template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+  void run_lane_scalar(int lane,
+                       size_t first_op,
+                       size_t last_op,
+                       BrainfuckReader reader,
+                       void* const reader_args[],
+                       BrainfuckWriter writer,
+                       void* const writer_args[],
+                       CellType* memory);
+  template <typename CellType, BrainfuckEofPolicy kEofPolicy>
+  void run_cells(int lane_count,
+                 BrainfuckReader reader,
+                 void* const reader_args[],
+                 BrainfuckWriter writer,
+                 void* const writer_args[],
+                 void* memory);
+
+  const int cell_bits_;
+  // Steps every lane through ops_ using the cell type and EOF policy chosen
+  // by the constructor (see select_cell_specialization).
+  const RunFunction run_cells_;
+  vector<BrainfuckOp> ops_;
+
+  // The state of the current call to "run".
+  // The lanes that are currently executing.
+  LaneMask active_;
+  // 0xff for each active lane and 0x00 for each inactive lane. Sign extending
+  // these gives a mask for any cell width.
+  uint8_t active_bytes_[kLanes];
+  // The data pointer of each lane, as a row number.
+  int64_t rows_[kLanes];
+  // True if every active lane has the same data pointer.
+  bool aligned_;
+};
+
+#endif  // BF_LOCKSTEP_H_
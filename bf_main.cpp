@@ -5,10 +5,15 @@
 // See http://en.wikipedia.org/wiki/Brainfuck.
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
@@ -17,21 +22,40 @@
 #include "bf_compile_and_go.h"
 #include "bf_interpreter.h"
 #include "bf_jit.h"
+#include "bf_lockstep.h"
 
 using std::string;
 using std::unique_ptr;
 using std::vector;
 
+// The number of cells of Brainfuck memory.
 const size_t kBrainfuckMemorySize = 1024 * 1024;
 
+// The number of bytes read at a time from a source that is not mapped.
+const size_t kSourceChunkSize = 64 * 1024;
+
+// The characters that are Brainfuck commands. Everything else is a comment.
+const char kBrainfuckCommands[] = "+-<>,.[]";
+
 const char USAGE[] = "Usage: %s [options] <Brainfuck file>\n"
                      "Execute the Brainfuck code in the given file e.g.\n"
                      "%s examples/hello.b\n"
+                     "If the file is \"-\" then the code is read from stdin.\n"
                      "\n"
                      "Options:\n"
                      "--mode=cag : Run using a compiler\n"
                      "--mode=i   : Run using an interpreter\n"
-                     "--mode=jit : Run using a Just-In-Time compiler\n";
+                     "--mode=jit : Run using a Just-In-Time compiler\n"
+                     "--batch    : Run once for each line of input, with many\n"
+                     "             lines being run at the same time\n"
+                     "--pipeline : With --mode=cag, start running the program\n"
+                     "             before it has been completely compiled\n"
+                     "--fragment-ops=N : With --mode=cag, compile the program\n"
+                     "                   in fragments of about N operations\n"
+                     "--cell-bits=8|16|32  : The size of each memory cell\n"
+                     "                       (default 8)\n"
+                     "--eof=0|-1|unchanged : The value stored by \",\" at\n"
+                     "                       the end of input (default 0)\n";
 
 // Passed to BrainfuckRunner->run(...) to provide output functionality for
 // the "." command.
@@ -41,68 +65,224 @@ static bool bf_write(void*, char c) {
 
 // Passed to BrainfuckRunner->run(...) to provide input functionality for
 // the "," command.
-static char bf_read(void*) {
+static int bf_read(void*) {
   int c = getchar();
   if (c == EOF) {
-    return 0;
+    return kBrainfuckEOF;
   } else {
     return c;
   }
 }
 
-int run_brainfuck_program(BrainfuckRunner* runner,
-                          const string& source_file_path) {
-  FILE *bf_source_file = fopen(source_file_path.c_str(), "rb");
-  if (bf_source_file == NULL) {
-    fprintf(stderr, "Could not open file \"%s\": %s\n",
-            source_file_path.c_str(), strerror(errno));
-    return 1;
+// Passed to BrainfuckLockstep->run(...) to provide output functionality for
+// the "." command. writer_arg is the string that the lane's output is
+// appended to.
+static bool bf_write_lane(void* writer_arg, char c) {
+  reinterpret_cast<string *>(writer_arg)->push_back(c);
+  return true;
+}
+
+// The input for a single lane of BrainfuckLockstep.
+struct LaneInput {
+  string::const_iterator next;
+  string::const_iterator end;
+};
+
+// Passed to BrainfuckLockstep->run(...) to provide input functionality for
+// the "," command. reader_arg is the LaneInput for the lane.
+static int bf_read_lane(void* reader_arg) {
+  LaneInput* input = reinterpret_cast<LaneInput *>(reader_arg);
+  if (input->next == input->end) {
+    return kBrainfuckEOF;
+  } else {
+    return static_cast<uint8_t>(*input->next++);
   }
+}
 
-  if (fseek(bf_source_file, 0, SEEK_END)) {
-    fprintf(stderr, "Could not seek in \"%s\": %s\n",
-            source_file_path.c_str(), strerror(ferror(bf_source_file)));
-    return 1;
+// The Brainfuck program being run. Regular files are mapped into memory.
+// Other sources (e.g. pipes) are read in chunks, keeping only the Brainfuck
+// commands, so the memory used depends on the size of the program rather than
+// the size of the source.
+struct BrainfuckSource {
+  BrainfuckSource() : start(NULL), end(NULL), mapping(NULL), mapping_size(0) {}
+  ~BrainfuckSource() {
+    if (mapping != NULL) {
+      munmap(mapping, mapping_size);
+    }
+  }
+
+  // The range of the source passed to BrainfuckRunner::init.
+  const char* start;
+  const char* end;
+  // The mapped file or NULL if the source was read.
+  void* mapping;
+  size_t mapping_size;
+  // The commands read from a source that was not mapped.
+  string commands;
+};
+
+// Reads the Brainfuck commands from fd, which is not mapped.
+static bool stream_brainfuck_source(int fd,
+                                    const string& source_file_path,
+                                    BrainfuckSource* source) {
+  char buffer[kSourceChunkSize];
+  ssize_t amount_read;
+  while ((amount_read = read(fd, buffer, sizeof(buffer))) != 0) {
+    if (amount_read == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Error reading file \"%s\": %s\n",
+              source_file_path.c_str(), strerror(errno));
+      return false;
+    }
+    for (ssize_t i = 0; i < amount_read; ++i) {
+      if (memchr(kBrainfuckCommands, buffer[i],
+                 sizeof(kBrainfuckCommands) - 1) != NULL) {
+        source->commands += buffer[i];
+      }
+    }
   }
+  source->start = source->commands.data();
+  source->end = source->start + source->commands.size();
+  return true;
+}
 
-  long source_size = ftell(bf_source_file);
-  if (source_size == -1) {
-    fprintf(stderr, "Could not tell in \"%s\": %s\n",
+// Loads the Brainfuck program from the given file or, if source_file_path is
+// "-", from stdin.
+static bool load_brainfuck_source(const string& source_file_path,
+                                  BrainfuckSource* source) {
+  if (source_file_path == "-") {
+    return stream_brainfuck_source(STDIN_FILENO, source_file_path, source);
+  }
+
+  int fd = open(source_file_path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Could not open file \"%s\": %s\n",
             source_file_path.c_str(), strerror(errno));
-    return 1;
+    return false;
   }
-  rewind(bf_source_file);
 
-  char* source_buffer = reinterpret_cast<char *>(malloc(source_size));
-  size_t amount_read = fread(source_buffer, 1, source_size, bf_source_file);
-  fclose(bf_source_file);
-  if (amount_read != static_cast<size_t>(source_size)) {
-    fprintf(stderr, "Error reading file \"%s\": %s\n",
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1) {
+    fprintf(stderr, "Could not stat file \"%s\": %s\n",
             source_file_path.c_str(), strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  if (S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+    void* mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE,
+                         fd, 0);
+    if (mapping != MAP_FAILED) {
+      close(fd);
+      source->mapping = mapping;
+      source->mapping_size = file_stat.st_size;
+      source->start = reinterpret_cast<const char *>(mapping);
+      source->end = source->start + source->mapping_size;
+      return true;
+    }
+  }
+
+  bool streamed = stream_brainfuck_source(fd, source_file_path, source);
+  close(fd);
+  return streamed;
+}
+
+int run_brainfuck_program(BrainfuckRunner* runner,
+                          int cell_bits,
+                          const string& source_file_path) {
+  BrainfuckSource source;
+  if (!load_brainfuck_source(source_file_path, &source)) {
     return 1;
   }
 
-  void* memory = calloc(kBrainfuckMemorySize, 1);
+  void* memory = calloc(kBrainfuckMemorySize, cell_bits / 8);
   if (memory == NULL) {
     fprintf(stderr,
             "Unable to allocate memory %ld bytes for Brainfuck memory\n",
-            static_cast<unsigned long>(kBrainfuckMemorySize));
+            static_cast<unsigned long>(kBrainfuckMemorySize * cell_bits / 8));
+    return 1;
   }
 
-  const string source(source_buffer, source_size);
-
-  if (!runner->init(source.begin(), source.end())) {
+  if (!runner->init(source.start, source.end)) {
+    free(memory);
     return 1;
   }
 
   runner->run(bf_read, NULL, bf_write, NULL, memory);
+  free(memory);
+  return runner->failed() ? 1 : 0;
+}
+
+// Runs the Brainfuck program once for each line of stdin (without the
+// trailing newline), using that line as the program's input. The output of
+// each run is written to stdout in the same order as the input lines.
+int run_brainfuck_batch(int cell_bits,
+                        BrainfuckEofPolicy eof_policy,
+                        const string& source_file_path) {
+  BrainfuckSource source;
+  if (!load_brainfuck_source(source_file_path, &source)) {
+    return 1;
+  }
+
+  BrainfuckLockstep lockstep(cell_bits, eof_policy);
+  if (!lockstep.init(source.start, source.end)) {
+    return 1;
+  }
+
+  string input;
+  char buffer[4096];
+  size_t amount_read;
+  while ((amount_read = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+    input.append(buffer, amount_read);
+  }
+
+  vector<LaneInput> lines;
+  string::const_iterator line_start = input.begin();
+  for (string::const_iterator it = input.begin(); it != input.end(); ++it) {
+    if (*it == '\n') {
+      lines.push_back({line_start, it});
+      line_start = it + 1;
+    }
+  }
+  if (line_start != input.end()) {
+    lines.push_back({line_start, input.end()});
+  }
+
+  const size_t kLanes = BrainfuckLockstep::kLanes;
+  for (size_t first_line = 0; first_line < lines.size(); first_line += kLanes) {
+    int lane_count = std::min(kLanes, lines.size() - first_line);
+    void* reader_args[kLanes];
+    void* writer_args[kLanes];
+    string outputs[kLanes];
+    for (int lane = 0; lane < lane_count; ++lane) {
+      reader_args[lane] = &lines[first_line + lane];
+      writer_args[lane] = &outputs[lane];
+    }
+
+    void* memory = calloc(kBrainfuckMemorySize * kLanes, cell_bits / 8);
+    if (memory == NULL) {
+      fprintf(stderr,
+              "Unable to allocate memory %ld bytes for Brainfuck memory\n",
+              static_cast<unsigned long>(
+                  kBrainfuckMemorySize * kLanes * cell_bits / 8));
+      return 1;
+    }
+    lockstep.run(lane_count,
+                 bf_read_lane, reader_args,
+                 bf_write_lane, writer_args,
+                 memory);
+    free(memory);
+
+    for (int lane = 0; lane < lane_count; ++lane) {
+      fwrite(outputs[lane].data(), 1, outputs[lane].size(), stdout);
+    }
+  }
   return 0;
 }
 
 int main(int argc, char *argv[]) {
-  unique_ptr<BrainfuckRunner> bf(new BrainfuckInterpreter());
-  string bf_file;
-
   for (int i = 1; i < argc; ++i) {
     if (argv[i] == string("-h") ||
         argv[i] == string("-help") ||
@@ -113,25 +293,56 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  string mode = "--mode=i";
+  bool batch = false;
+  bool pipeline = false;
+  size_t fragment_ops = 0;
+  int cell_bits = 8;
+  BrainfuckEofPolicy eof_policy = kEofZero;
   vector<string> files;
   for (int i = 1; i < argc; ++i) {
     string arg(argv[i]);
     if (arg.find("--") == 0) {
       if (arg.find("--mode=") == 0) {
-        if (arg == "--mode=cag") {
-          unique_ptr<BrainfuckRunner> compile_and_go(
-              new BrainfuckCompileAndGo());
-          bf = std::move(compile_and_go);
-        } else if (arg == "--mode=i") {
-          unique_ptr<BrainfuckRunner> interpreter(new BrainfuckInterpreter());
-          bf = std::move(interpreter);
-        } else if (arg == "--mode=jit") {
-          unique_ptr<BrainfuckRunner> jit(new BrainfuckJIT());
-          bf = std::move(jit);
-        } else {
+        if (arg != "--mode=cag" && arg != "--mode=i" && arg != "--mode=jit") {
           fprintf(stderr, "Unexpected mode: %s\n", arg.c_str());
           return 1;
         }
+        mode = arg;
+      } else if (arg == "--batch") {
+        batch = true;
+      } else if (arg == "--pipeline") {
+        pipeline = true;
+      } else if (arg.find("--fragment-ops=") == 0) {
+        char* end;
+        fragment_ops = strtoul(arg.c_str() + strlen("--fragment-ops="), &end,
+                               10);
+        if (*end != '\0' || fragment_ops == 0) {
+          fprintf(stderr, "Unexpected fragment ops: %s\n", arg.c_str());
+          return 1;
+        }
+      } else if (arg.find("--cell-bits=") == 0) {
+        if (arg == "--cell-bits=8") {
+          cell_bits = 8;
+        } else if (arg == "--cell-bits=16") {
+          cell_bits = 16;
+        } else if (arg == "--cell-bits=32") {
+          cell_bits = 32;
+        } else {
+          fprintf(stderr, "Unexpected cell bits: %s\n", arg.c_str());
+          return 1;
+        }
+      } else if (arg.find("--eof=") == 0) {
+        if (arg == "--eof=0") {
+          eof_policy = kEofZero;
+        } else if (arg == "--eof=-1") {
+          eof_policy = kEofMinusOne;
+        } else if (arg == "--eof=unchanged") {
+          eof_policy = kEofUnchanged;
+        } else {
+          fprintf(stderr, "Unexpected EOF behavior: %s\n", arg.c_str());
+          return 1;
+        }
       } else {
         fprintf(stderr, "Unexpected argument: %s\n", arg.c_str());
         return 1;
@@ -147,5 +358,22 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  return run_brainfuck_program(bf.get(), files[0]);
+  if (batch) {
+    return run_brainfuck_batch(cell_bits, eof_policy, files[0]);
+  }
+
+  unique_ptr<BrainfuckRunner> bf;
+  if (mode == "--mode=cag") {
+    BrainfuckCompileAndGo* cag =
+        new BrainfuckCompileAndGo(cell_bits, eof_policy, true, pipeline);
+    if (fragment_ops != 0) {
+      cag->set_fragment_ops(fragment_ops);
+    }
+    bf.reset(cag);
+  } else if (mode == "--mode=jit") {
+    bf.reset(new BrainfuckJIT(cell_bits, eof_policy));
+  } else {
+    bf.reset(new BrainfuckInterpreter(cell_bits, eof_policy));
+  }
+  return run_brainfuck_program(bf.get(), cell_bits, files[0]);
 }
@@ -0,0 +1,266 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+
+#include <cstdint>
+#include <map>
+#include <set>
+
+#include "bf_optimizer.h"
+
+using std::map;
+using std::set;
+
+// What is known about the values of the memory cells at a point in the
+// program. Cells are identified by their offset from the position of the data
+// pointer when tracking started.
+class KnownCells {
+ public:
+  explicit KnownCells(bool others_zero) :
+      others_zero_(others_zero), position_(0) {}
+
+  int64_t position() const { return position_; }
+  void move(int64_t offset) { position_ += offset; }
+
+  // Returns true and sets *value if the value of the cell at the given offset
+  // from the data pointer is known.
+  bool get(int64_t offset, uint32_t* value) const {
+    auto it = values_.find(position_ + offset);
+    if (it == values_.end()) {
+      *value = 0;
+      return others_zero_;
+    }
+    *value = it->second;
+    return it->second != kUnknown;
+  }
+
+  void set(int64_t offset, uint32_t value) {
+    values_[position_ + offset] = value;
+  }
+
+  void forget(int64_t offset) {
+    values_[position_ + offset] = kUnknown;
+  }
+
+ private:
+  // Cell values are stored in a wider type so that kUnknown cannot be
+  // mistaken for a real value.
+  static const int64_t kUnknown = -1;
+
+  // If true then cells not in values_ are known to be zero.
+  bool others_zero_;
+  // The position of the data pointer.
+  int64_t position_;
+  // Maps the position of a cell to its value or kUnknown.
+  map<int64_t, int64_t> values_;
+};
+
+// The cells that may be changed by one iteration of a loop.
+struct LoopWrites {
+  LoopWrites() : position(0), balanced(true) {}
+
+  // The offsets of the cells, relative to the data pointer position at the
+  // start of the iteration.
+  set<int64_t> offsets;
+  // The data pointer position, relative to the start of the iteration, while
+  // the writes are being found.
+  int64_t position;
+  // False if the data pointer position at the end of an iteration may differ
+  // from the position at the start, in which case offsets is incomplete.
+  bool balanced;
+};
+
+// Finds the writes of every loop in ops and stores them in loop_writes, keyed
+// by the index of the kLoopStart op. Each loop is visited once and the writes
+// of a nested loop are added to those of the loop containing it, so the cost
+// does not depend on how deeply the loops are nested.
+static void find_loop_writes(const vector<BrainfuckOp>& ops,
+                             map<size_t, LoopWrites>* loop_writes) {
+  vector<LoopWrites> open_loops;
+  for (size_t i = 0; i < ops.size(); ++i) {
+    if (ops[i].opcode == kLoopStart) {
+      open_loops.push_back(LoopWrites());
+      continue;
+    }
+    if (open_loops.empty()) {
+      continue;
+    }
+
+    LoopWrites* writes = &open_loops.back();
+    switch (ops[i].opcode) {
+      case kAdd:
+      case kSet:
+        writes->offsets.insert(writes->position + ops[i].offset);
+        break;
+      case kMove:
+        writes->position += ops[i].offset;
+        break;
+      case kRead:
+        writes->offsets.insert(writes->position);
+        break;
+      case kLoopEnd:
+        {
+          writes->balanced = writes->balanced && writes->position == 0;
+          if (open_loops.size() > 1) {
+            LoopWrites* outer = &open_loops[open_loops.size() - 2];
+            if (!writes->balanced) {
+              outer->balanced = false;
+            } else {
+              for (auto it = writes->offsets.begin();
+                   it != writes->offsets.end();
+                   ++it) {
+                outer->offsets.insert(outer->position + *it);
+              }
+            }
+          }
+          (*loop_writes)[ops[i].match].offsets.swap(writes->offsets);
+          (*loop_writes)[ops[i].match].balanced = writes->balanced;
+          open_loops.pop_back();
+        }
+        break;
+      case kWrite:
+      case kLoopStart:
+      case kGuard:
+      case kGuardEqual:
+        break;
+    }
+  }
+}
+
+// Returns true if ops[loop_start] is the start of a loop like "[-]" or "[+]"
+// that always sets the current cell to zero.
+static bool is_clear_loop(const vector<BrainfuckOp>& ops, size_t loop_start) {
+  const BrainfuckOp& body = ops[loop_start + 1];
+  // Adding an odd number will eventually reach zero for any cell width.
+  return ops[loop_start].match == loop_start + 2 &&
+      body.opcode == kAdd && body.offset == 0 && (body.value & 1);
+}
+
+// Appends the optimized form of ops[start, end) to optimized, updating known
+// to reflect the state of the memory after ops[start, end) are executed.
+// loop_writes must contain the writes of every loop in ops.
+static void optimize_sequence(const vector<BrainfuckOp>& ops,
+                              size_t start,
+                              size_t end,
+                              uint32_t cell_mask,
+                              const map<size_t, LoopWrites>& loop_writes,
+                              KnownCells* known,
+                              vector<BrainfuckOp>* optimized) {
+  for (size_t i = start; i < end; ++i) {
+    BrainfuckOp op = ops[i];
+    uint32_t value;
+
+    switch (op.opcode) {
+      case kAdd:
+        if ((op.value & cell_mask) == 0) {
+          break;
+        }
+        if (known->get(op.offset, &value)) {
+          op.opcode = kSet;
+          op.value = (value + op.value) & cell_mask;
+          known->set(op.offset, op.value);
+        }
+        optimized->push_back(op);
+        break;
+      case kSet:
+        if (known->get(op.offset, &value) &&
+            value == (op.value & cell_mask)) {
+          break;
+        }
+        known->set(op.offset, op.value & cell_mask);
+        optimized->push_back(op);
+        break;
+      case kMove:
+        known->move(op.offset);
+        optimized->push_back(op);
+        break;
+      case kRead:
+        known->forget(0);
+        optimized->push_back(op);
+        break;
+      case kWrite:
+        optimized->push_back(op);
+        break;
+      case kLoopStart:
+        if (known->get(0, &value) && value == 0) {
+          // The loop will never be entered.
+          i = op.match;
+          break;
+        }
+
+        if (is_clear_loop(ops, i)) {
+          BrainfuckOp clear(kSet, op.source);
+          known->set(0, 0);
+          optimized->push_back(clear);
+          i = op.match;
+          break;
+        }
+
+        {
+          const LoopWrites& writes = loop_writes.find(i)->second;
+          if (writes.balanced) {
+            // The cells that the loop does not change have the same values on
+            // every iteration and after the loop.
+            for (auto it = writes.offsets.begin();
+                 it != writes.offsets.end();
+                 ++it) {
+              known->forget(*it);
+            }
+          } else {
+            *known = KnownCells(false);
+          }
+
+          size_t optimized_loop_start = optimized->size();
+          optimized->push_back(op);
+
+          KnownCells body_known(*known);
+          optimize_sequence(ops, i + 1, op.match, cell_mask, loop_writes,
+                            &body_known, optimized);
+
+          BrainfuckOp loop_end = ops[op.match];
+          loop_end.match = optimized_loop_start;
+          (*optimized)[optimized_loop_start].match = optimized->size();
+          optimized->push_back(loop_end);
+
+          // The loop only exits when the current cell is zero.
+          known->set(0, 0);
+          i = op.match;
+        }
+        break;
+      case kLoopEnd:
+        break;
+      case kGuard:
+        if (known->get(0, &value) && (value != 0) == (op.value != 0)) {
+          // The guard can never fail.
+          break;
+        }
+        if (!op.value) {
+          // Execution only continues past the guard if the cell is zero.
+          known->set(0, 0);
+        }
+        optimized->push_back(op);
+        break;
+      case kGuardEqual:
+        if (known->get(0, &value) && value == (op.value & cell_mask)) {
+          break;
+        }
+        known->set(0, op.value & cell_mask);
+        optimized->push_back(op);
+        break;
+    }
+  }
+}
+
+void optimize_brainfuck(int cell_bits,
+                        bool zeroed_memory,
+                        vector<BrainfuckOp>* ops) {
+  uint32_t cell_mask = cell_bits == 32 ? 0xffffffff : (1u << cell_bits) - 1;
+  KnownCells known(zeroed_memory);
+  vector<BrainfuckOp> optimized;
+
+  map<size_t, LoopWrites> loop_writes;
+  find_loop_writes(*ops, &loop_writes);
+
+  optimize_sequence(*ops, 0, ops->size(), cell_mask, loop_writes, &known,
+                    &optimized);
+  ops->swap(optimized);
+}
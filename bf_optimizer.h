@@ -0,0 +1,30 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+//
+// Optimizes Brainfuck IR (see bf_ir.h) by tracking which cells have values
+// that are known when the program is compiled. For example, in:
+//
+// [-]+++>[-]<[>+<-]>[<+>-]
+//
+// The first "[-]" becomes a store of 0, so the following "+++" becomes a store
+// of 3. The second "[-]" is removed if the cell was already known to be zero
+// and the final loop is removed because the cell that it tests is always zero
+// after the preceding loop.
+
+#ifndef BF_OPTIMIZER_H_
+#define BF_OPTIMIZER_H_
+
+#include <vector>
+
+#include "bf_ir.h"
+
+using std::vector;
+
+// Optimizes ops in place. cell_bits (8, 16 or 32) is the width of the cells
+// that the code will operate on. If zeroed_memory is true then every cell is
+// assumed to be zero when the code starts.
+void optimize_brainfuck(int cell_bits,
+                        bool zeroed_memory,
+                        vector<BrainfuckOp>* ops);
+
+#endif  // BF_OPTIMIZER_H_
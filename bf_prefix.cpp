@@ -0,0 +1,83 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+
+#include <cstdint>
+
+#include "bf_prefix.h"
+
+template <typename CellType>
+static void evaluate_prefix_cells(const vector<BrainfuckOp>& ops,
+                                  size_t max_steps,
+                                  size_t max_cells,
+                                  BrainfuckPrefix* prefix) {
+  vector<CellType> memory;
+  size_t data_pointer = 0;
+  size_t i = 0;
+
+  for (size_t step = 0; step < max_steps && i < ops.size(); ++step) {
+    const BrainfuckOp& op = ops[i];
+    if (op.opcode == kRead) {
+      break;
+    } else if (op.opcode == kAdd || op.opcode == kSet ||
+               op.opcode == kMove) {
+      int64_t cell = static_cast<int64_t>(data_pointer) + op.offset;
+      if (cell < 0 || cell >= static_cast<int64_t>(max_cells)) {
+        break;
+      }
+      if (op.opcode == kMove) {
+        data_pointer = cell;
+        ++i;
+        continue;
+      }
+      if (static_cast<size_t>(cell) >= memory.size()) {
+        memory.resize(cell + 1);
+      }
+      if (op.opcode == kSet) {
+        memory[cell] = op.value;
+      } else {
+        memory[cell] += op.value;
+      }
+      ++i;
+      continue;
+    }
+
+    CellType value = data_pointer < memory.size() ? memory[data_pointer] : 0;
+    switch (op.opcode) {
+      case kWrite:
+        prefix->output += static_cast<char>(value);
+        ++i;
+        break;
+      case kLoopStart:
+        i = value ? i + 1 : op.match + 1;
+        break;
+      case kLoopEnd:
+        i = value ? op.match + 1 : i + 1;
+        break;
+      default:
+        break;
+    }
+  }
+
+  prefix->memory.assign(reinterpret_cast<const char *>(memory.data()),
+                        memory.size() * sizeof(CellType));
+  prefix->data_pointer = data_pointer;
+  prefix->resume_op = i;
+}
+
+void evaluate_prefix(const vector<BrainfuckOp>& ops,
+                     int cell_bits,
+                     size_t max_steps,
+                     size_t max_cells,
+                     BrainfuckPrefix* prefix) {
+  switch (cell_bits) {
+    case 16:
+      evaluate_prefix_cells<uint16_t>(ops, max_steps, max_cells, prefix);
+      break;
+    case 32:
+      evaluate_prefix_cells<uint32_t>(ops, max_steps, max_cells, prefix);
+      break;
+    default:
+      evaluate_prefix_cells<uint8_t>(ops, max_steps, max_cells, prefix);
+      break;
+  }
+}
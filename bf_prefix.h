@@ -0,0 +1,46 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+//
+// Evaluates the part of a Brainfuck program that does not depend on its input
+// i.e. everything before the first "," is evaluated. This allows the output
+// and memory state at that point to be computed once, when the program is
+// initialized, rather than every time that it is run.
+
+#ifndef BF_PREFIX_H_
+#define BF_PREFIX_H_
+
+#include <string>
+#include <vector>
+
+#include "bf_ir.h"
+
+using std::string;
+using std::vector;
+
+// The state of a Brainfuck program, started with zeroed memory, after running
+// until it required input (or was stopped).
+struct BrainfuckPrefix {
+  BrainfuckPrefix() : data_pointer(0), resume_op(0) {}
+
+  // The output written by the program.
+  string output;
+  // The memory (as raw cells) from the first cell to the last cell that was
+  // changed.
+  string memory;
+  // The position of the data pointer, in cells.
+  size_t data_pointer;
+  // The index of the next op to execute or the number of ops if the program
+  // has finished.
+  size_t resume_op;
+};
+
+// Runs ops, starting with zeroed memory, until a kRead op is reached, the
+// program finishes, max_steps ops have been executed or an op would access a
+// cell outside of [0, max_cells). cell_bits must be 8, 16 or 32.
+void evaluate_prefix(const vector<BrainfuckOp>& ops,
+                     int cell_bits,
+                     size_t max_steps,
+                     size_t max_cells,
+                     BrainfuckPrefix* prefix);
+
+#endif  // BF_PREFIX_H_
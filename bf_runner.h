@@ -11,18 +11,33 @@
 
 using std::string;
 
+// The value returned by a BrainfuckReader when there is no more input.
+const int kBrainfuckEOF = -1;
+
 typedef bool (*BrainfuckWriter)(void* writer_arg, char c);
-typedef char (*BrainfuckReader)(void* reader_arg);
+// Returns the next input byte (0-255) or kBrainfuckEOF.
+typedef int (*BrainfuckReader)(void* reader_arg);
+
+// The effect of evaluating "," when the reader returns kBrainfuckEOF.
+enum BrainfuckEofPolicy {
+  kEofZero,       // Set the cell to 0.
+  kEofMinusOne,   // Set the cell to -1 i.e. all bits set.
+  kEofUnchanged,  // Leave the cell unchanged.
+};
 
 class BrainfuckRunner {
  public:
-  // Initialize the runner using the Brainfuck opcodes between the given
-  // iterators. Returns false if the Brainfuck code is invalid (i.e. there
-  // is a "[" with a matching "]") or there is another initialization error.
-  virtual bool init(string::const_iterator start,
-                    string::const_iterator end) = 0;
+  virtual ~BrainfuckRunner() {}
 
-  // Runs the Brainfuck code given in "init" using the provided memory.
+  // Initialize the runner using the Brainfuck opcodes in [start, end). The
+  // range is not copied and must remain valid while the runner is used.
+  // Returns false if the Brainfuck code is invalid (i.e. there is a "[" with
+  // a matching "]") or there is another initialization error.
+  virtual bool init(const char* start, const char* end) = 0;
+
+  // Runs the Brainfuck code given in "init" using the provided memory, which
+  // is treated as an array of cells of the width given when the runner was
+  // constructed.
   // When "," is evaluated, call reader(reader_arg).
   // When "." is evaluated, call writer(writer_arg, <char to write>)
   // The return value is the location of the data pointer
@@ -33,6 +48,11 @@ class BrainfuckRunner {
                     BrainfuckWriter writer,
                     void* writer_arg,
                     void* memory) = 0;
+
+  // Returns true if the last call to "run" stopped before the Brainfuck code
+  // finished because of an error in the runner (e.g. part of the code could
+  // not be compiled) rather than because a write failed.
+  virtual bool failed() const { return false; }
 };
 
 #endif  // BF_RUNNER_H_
@@ -0,0 +1,457 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+//
+// Translates Brainfuck code into C++ at C++ compile time. The Brainfuck code
+// must be a constexpr char array with static storage duration e.g.
+//
+// constexpr char kHelloWorld[] = "++++++++++[>+++++++>++++++++++>+++>+<<<<-]"
+//                                ">++.>+.+++++++..+++.>++.<<+++++++++++++++."
+//                                ">.+++.------.--------.>+.>.";
+// ...
+// BrainfuckStatic<kHelloWorld>::run(reader, NULL, writer, NULL, memory);
+//
+// The code is folded the same way as BrainfuckCompileAndGo: runs of "+", "-",
+// "<" and ">" become one addition per memory location changed (additions that
+// cancel out are dropped) followed by a single data pointer move, loops like
+// "[-]" become stores of zero and other loops become "while" loops. Since the
+// C++ compiler sees the complete program, it can optimize it further and no
+// executable memory needs to be allocated at runtime.
+//
+// Each segment of a loop body (a loop, "," or "." or a run of the other
+// commands) requires a level of template recursion so very large programs may
+// require raising the compiler's template depth limit (-ftemplate-depth).
+// Scanning the source uses divide and conquer, so the constexpr recursion
+// depth only grows with the logarithm of the program size.
+
+#ifndef BF_STATIC_H_
+#define BF_STATIC_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "bf_cell.h"
+#include "bf_runner.h"
+
+namespace bf_static {
+
+// Returns true if source[start, start + count) does not contain '\0'. Never
+// reads past the first '\0'.
+constexpr bool no_terminator(const char* source, size_t start, size_t count) {
+  return count == 0 ? true :
+         count == 1 ? source[start] != '\0' :
+         no_terminator(source, start, count / 2) &&
+         no_terminator(source, start + count / 2, count - count / 2);
+}
+
+// Returns the position of the first '\0' in source[start, end), which must
+// contain a '\0'.
+constexpr size_t find_terminator(const char* source, size_t start, size_t end) {
+  return end - start == 1 ? start :
+         no_terminator(source, start, (end - start) / 2) ?
+         find_terminator(source, start + (end - start) / 2, end) :
+         find_terminator(source, start, start + (end - start) / 2);
+}
+
+// Returns the length of the '\0' terminated string source, searching in
+// blocks of doubling size.
+constexpr size_t source_length(const char* source, size_t block_size = 1) {
+  return no_terminator(source, 0, block_size) ?
+         source_length(source, block_size * 2) :
+         find_terminator(source, 0, block_size);
+}
+
+constexpr int bracket_change(char c) {
+  return c == '[' ? 1 : c == ']' ? -1 : 0;
+}
+
+constexpr int pointer_change(char c) {
+  return c == '>' ? 1 : c == '<' ? -1 : 0;
+}
+
+constexpr int cell_change(char c) {
+  return c == '+' ? 1 : c == '-' ? -1 : 0;
+}
+
+constexpr bool ends_arithmetic(char c) {
+  return c == '[' || c == ']' || c == ',' || c == '.';
+}
+
+// The sum of change(c) for each c in source[start, end).
+constexpr int64_t sum(const char* source,
+                      size_t start,
+                      size_t end,
+                      int (*change)(char c)) {
+  return end - start == 0 ? 0 :
+         end - start == 1 ? change(source[start]) :
+         sum(source, start, start + (end - start) / 2, change) +
+         sum(source, start + (end - start) / 2, end, change);
+}
+
+// The number of c in source[start, end) for which pointer_change(c) != 0.
+constexpr size_t count_moves(const char* source, size_t start, size_t end) {
+  return end - start == 0 ? 0 :
+         end - start == 1 ? pointer_change(source[start]) != 0 :
+         count_moves(source, start, start + (end - start) / 2) +
+         count_moves(source, start + (end - start) / 2, end);
+}
+
+constexpr int64_t min(int64_t a, int64_t b) {
+  return a < b ? a : b;
+}
+
+constexpr int64_t max(int64_t a, int64_t b) {
+  return a > b ? a : b;
+}
+
+// The smallest value of sum(source, start, i, change) for i in (start, end].
+// start must be less than end.
+constexpr int64_t min_prefix(const char* source,
+                             size_t start,
+                             size_t end,
+                             int (*change)(char c)) {
+  return end - start == 1 ? change(source[start]) :
+         min(min_prefix(source, start, start + (end - start) / 2, change),
+             sum(source, start, start + (end - start) / 2, change) +
+             min_prefix(source, start + (end - start) / 2, end, change));
+}
+
+// The largest value of sum(source, start, i, change) for i in (start, end].
+// start must be less than end.
+constexpr int64_t max_prefix(const char* source,
+                             size_t start,
+                             size_t end,
+                             int (*change)(char c)) {
+  return end - start == 1 ? change(source[start]) :
+         max(max_prefix(source, start, start + (end - start) / 2, change),
+             sum(source, start, start + (end - start) / 2, change) +
+             max_prefix(source, start + (end - start) / 2, end, change));
+}
+
+// The smallest value of sum(source, start, i, bracket_change) for i in
+// (start, end]. start must be less than end.
+constexpr int64_t min_bracket_prefix(const char* source,
+                                     size_t start,
+                                     size_t end) {
+  return min_prefix(source, start, end, bracket_change);
+}
+
+// The sum of cell_change(c) for each c in source[start, end) that is
+// evaluated when the data pointer is at offset (relative to its position at
+// start) i.e. the combined change to the cell at that offset.
+constexpr int64_t offset_change(const char* source,
+                                size_t start,
+                                size_t end,
+                                int64_t offset) {
+  return end - start == 0 ? 0 :
+         end - start == 1 ? (offset == 0 ? cell_change(source[start]) : 0) :
+         offset_change(source, start, start + (end - start) / 2, offset) +
+         offset_change(
+             source, start + (end - start) / 2, end,
+             offset -
+             sum(source, start, start + (end - start) / 2, pointer_change));
+}
+
+constexpr size_t find_bracket_prefix(const char* source,
+                                     size_t start,
+                                     size_t end,
+                                     int64_t target);
+
+// Returns left_found if it is a position in source[start, middle) and
+// otherwise searches source[middle, end).
+constexpr size_t find_bracket_prefix_in_right(const char* source,
+                                              size_t start,
+                                              size_t middle,
+                                              size_t end,
+                                              int64_t target,
+                                              size_t left_found) {
+  return left_found != middle ? left_found :
+         find_bracket_prefix(
+             source, middle, end,
+             target - sum(source, start, middle, bracket_change));
+}
+
+// Returns the first i in [start, end) where
+// sum(source, start, i + 1, bracket_change) == target (which must be
+// negative) or end if there is no such i.
+constexpr size_t find_bracket_prefix(const char* source,
+                                     size_t start,
+                                     size_t end,
+                                     int64_t target) {
+  return end == start || min_bracket_prefix(source, start, end) > target ?
+         end :
+         end - start == 1 ? start :
+         find_bracket_prefix_in_right(
+             source, start, start + (end - start) / 2, end, target,
+             find_bracket_prefix(source, start, start + (end - start) / 2,
+                                 target));
+}
+
+constexpr size_t min(size_t a, size_t b) {
+  return a < b ? a : b;
+}
+
+// Returns the position of the "]" matching the "[" before body_start, or end
+// if there is no matching "]", by searching windows of doubling size (so that
+// the cost is proportional to the size of the loop rather than the size of the
+// remaining code).
+constexpr size_t find_loop_end_in_window(const char* source,
+                                         size_t body_start,
+                                         size_t end,
+                                         size_t window_size,
+                                         size_t found) {
+  return found != min(body_start + window_size, end) ? found :
+         found == end ? end :
+         find_loop_end_in_window(
+             source, body_start, end, window_size * 2,
+             find_bracket_prefix(source, body_start,
+                                 min(body_start + window_size * 2, end), -1));
+}
+
+// Returns the position of the "]" matching the "[" at loop_start or end if
+// there is no matching "]".
+constexpr size_t find_loop_end(const char* source,
+                               size_t loop_start,
+                               size_t end) {
+  return find_loop_end_in_window(
+      source, loop_start + 1, end, 16,
+      find_bracket_prefix(source, loop_start + 1,
+                          min(loop_start + 1 + 16, end), -1));
+}
+
+constexpr size_t find_arithmetic_end(const char* source,
+                                     size_t start,
+                                     size_t end);
+
+// Returns left_found if it is a position in source[start, middle) and
+// otherwise searches source[middle, end).
+constexpr size_t find_arithmetic_end_in_right(const char* source,
+                                              size_t middle,
+                                              size_t end,
+                                              size_t left_found) {
+  return left_found != middle ? left_found :
+         find_arithmetic_end(source, middle, end);
+}
+
+// Returns the position of the first "[", "]", "," or "." in
+// source[start, end) or end if there is none.
+constexpr size_t find_arithmetic_end(const char* source,
+                                     size_t start,
+                                     size_t end) {
+  return end - start == 0 ? end :
+         end - start == 1 ? (ends_arithmetic(source[start]) ? start : end) :
+         find_arithmetic_end_in_right(
+             source, start + (end - start) / 2, end,
+             find_arithmetic_end(source, start, start + (end - start) / 2));
+}
+
+// Like find_arithmetic_end but searches windows of doubling size.
+constexpr size_t find_arithmetic_end_in_window(const char* source,
+                                               size_t start,
+                                               size_t end,
+                                               size_t window_size,
+                                               size_t found) {
+  return found != min(start + window_size, end) ? found :
+         found == end ? end :
+         find_arithmetic_end_in_window(
+             source, start, end, window_size * 2,
+             find_arithmetic_end(source, start,
+                                 min(start + window_size * 2, end)));
+}
+
+// Returns true if source[start, end) (the body of a loop) only adds an odd
+// amount to the current cell, like "-" or "+++". Such loops always end with
+// the cell set to zero, for any cell width.
+constexpr bool is_clear_loop_body(const char* source,
+                                  size_t start,
+                                  size_t end) {
+  return end != start &&
+         find_arithmetic_end(source, start, end) == end &&
+         count_moves(source, start, end) == 0 &&
+         sum(source, start, end, cell_change) % 2 != 0;
+}
+
+enum SegmentKind {
+  kEmpty,
+  kArithmetic,  // A run of "+", "-", "<" and ">".
+  kRead,
+  kWrite,
+  kLoop,
+  kUnmatchedLoopEnd,
+};
+
+constexpr SegmentKind segment_kind(const char* source,
+                                   size_t start,
+                                   size_t end) {
+  return start == end ? kEmpty :
+         source[start] == ',' ? kRead :
+         source[start] == '.' ? kWrite :
+         source[start] == '[' ? kLoop :
+         source[start] == ']' ? kUnmatchedLoopEnd :
+         kArithmetic;
+}
+
+}  // namespace bf_static
+
+template <const char* kSource,
+          typename CellType = uint8_t,
+          BrainfuckEofPolicy kEofPolicy = kEofZero>
+class BrainfuckStatic {
+ public:
+  // Runs the Brainfuck code given in kSource using the provided memory.
+  // Behaves like BrainfuckRunner::run.
+  static void* run(BrainfuckReader reader,
+                   void* reader_arg,
+                   BrainfuckWriter writer,
+                   void* writer_arg,
+                   void* memory) {
+    Io io = {reader, reader_arg, writer, writer_arg};
+    CellType* cell = reinterpret_cast<CellType *>(memory);
+    Sequence<0, bf_static::source_length(kSource)>::run(io, &cell);
+    return cell;
+  }
+
+ private:
+  struct Io {
+    BrainfuckReader reader;
+    void* reader_arg;
+    BrainfuckWriter writer;
+    void* writer_arg;
+  };
+
+  // Adds kChange to the cell at kOffset from cell. Nothing is done for
+  // changes that cancel out.
+  template <int64_t kOffset, CellType kChange>
+  struct CellChange {
+    static inline void apply(CellType* cell) {
+      cell[kOffset] += kChange;
+    }
+  };
+
+  template <int64_t kOffset>
+  struct CellChange<kOffset, 0> {
+    static inline void apply(CellType*) {}
+  };
+
+  // Applies the "+" and "-" commands in kSource[kStart, kEnd) to the cells at
+  // offsets [kFirst, kLast] from cell, without moving the data pointer. All
+  // of the changes to each cell are combined into a single addition.
+  template <size_t kStart,
+            size_t kEnd,
+            int64_t kFirst,
+            int64_t kLast,
+            bool kSingleCell = kFirst == kLast>
+  struct Changes {
+    static inline void apply(CellType* cell) {
+      CellChange<kFirst,
+                 static_cast<CellType>(bf_static::offset_change(
+                     kSource, kStart, kEnd, kFirst))>::apply(cell);
+    }
+  };
+
+  template <size_t kStart, size_t kEnd, int64_t kFirst, int64_t kLast>
+  struct Changes<kStart, kEnd, kFirst, kLast, false> {
+    static const int64_t kMiddle = kFirst + (kLast - kFirst) / 2;
+
+    static inline void apply(CellType* cell) {
+      Changes<kStart, kEnd, kFirst, kMiddle>::apply(cell);
+      Changes<kStart, kEnd, kMiddle + 1, kLast>::apply(cell);
+    }
+  };
+
+  // Runs a loop with the body kSource[kBodyStart, kBodyEnd).
+  template <size_t kBodyStart, size_t kBodyEnd, bool kClear>
+  struct Loop {
+    static inline void run(const Io& io, CellType** cell) {
+      while (**cell) {
+        Sequence<kBodyStart, kBodyEnd>::run(io, cell);
+      }
+    }
+  };
+
+  // A loop like "[-]" always sets the current cell to zero.
+  template <size_t kBodyStart, size_t kBodyEnd>
+  struct Loop<kBodyStart, kBodyEnd, true> {
+    static inline void run(const Io&, CellType** cell) {
+      **cell = 0;
+    }
+  };
+
+  // Runs the Brainfuck code in kSource[kStart, kEnd), which must not contain
+  // a "]" without a matching "[".
+  template <size_t kStart,
+            size_t kEnd,
+            bf_static::SegmentKind kKind =
+                bf_static::segment_kind(kSource, kStart, kEnd)>
+  struct Sequence;
+
+  template <size_t kStart, size_t kEnd>
+  struct Sequence<kStart, kEnd, bf_static::kEmpty> {
+    static inline void run(const Io&, CellType**) {}
+  };
+
+  template <size_t kStart, size_t kEnd>
+  struct Sequence<kStart, kEnd, bf_static::kArithmetic> {
+    static const size_t kArithmeticEnd =
+        bf_static::find_arithmetic_end_in_window(
+            kSource, kStart, kEnd, 16,
+            bf_static::find_arithmetic_end(
+                kSource, kStart, bf_static::min(kStart + 16, kEnd)));
+
+    // The range of data pointer offsets visited by the run.
+    static const int64_t kFirst = bf_static::min(
+        0, bf_static::min_prefix(kSource, kStart, kArithmeticEnd,
+                                 bf_static::pointer_change));
+    static const int64_t kLast = bf_static::max(
+        0, bf_static::max_prefix(kSource, kStart, kArithmeticEnd,
+                                 bf_static::pointer_change));
+
+    static inline void run(const Io& io, CellType** cell) {
+      Changes<kStart, kArithmeticEnd, kFirst, kLast>::apply(*cell);
+      *cell += bf_static::sum(
+          kSource, kStart, kArithmeticEnd, bf_static::pointer_change);
+      Sequence<kArithmeticEnd, kEnd>::run(io, cell);
+    }
+  };
+
+  template <size_t kStart, size_t kEnd>
+  struct Sequence<kStart, kEnd, bf_static::kRead> {
+    static inline void run(const Io& io, CellType** cell) {
+      read_cell<CellType, kEofPolicy>(io.reader, io.reader_arg, *cell);
+      Sequence<kStart + 1, kEnd>::run(io, cell);
+    }
+  };
+
+  template <size_t kStart, size_t kEnd>
+  struct Sequence<kStart, kEnd, bf_static::kWrite> {
+    static inline void run(const Io& io, CellType** cell) {
+      io.writer(io.writer_arg, **cell);
+      Sequence<kStart + 1, kEnd>::run(io, cell);
+    }
+  };
+
+  template <size_t kStart, size_t kEnd>
+  struct Sequence<kStart, kEnd, bf_static::kLoop> {
+    static const size_t kLoopEnd =
+        bf_static::find_loop_end(kSource, kStart, kEnd);
+    static_assert(kLoopEnd != kEnd,
+                  "Unable to find loop end in Brainfuck block");
+
+    static inline void run(const Io& io, CellType** cell) {
+      Loop<kStart + 1,
+           kLoopEnd,
+           bf_static::is_clear_loop_body(kSource, kStart + 1, kLoopEnd)>::run(
+               io, cell);
+      Sequence<kLoopEnd + 1, kEnd>::run(io, cell);
+    }
+  };
+
+  // Like BrainfuckCompileAndGo, a "]" without a matching "[" is ignored.
+  template <size_t kStart, size_t kEnd>
+  struct Sequence<kStart, kEnd, bf_static::kUnmatchedLoopEnd> {
+    static inline void run(const Io& io, CellType** cell) {
+      Sequence<kStart + 1, kEnd>::run(io, cell);
+    }
+  };
+};
+
+#endif  // BF_STATIC_H_
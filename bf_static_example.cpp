@@ -0,0 +1,40 @@
+// Copyright 2014 Brian Quinlan
+// See "LICENSE" file for details.
+//
+// Runs Brainfuck code that was translated into C++ at compile time by
+// BrainfuckStatic (see bf_static.h).
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bf_static.h"
+
+// The same code as examples/hello.b.
+constexpr char kHelloWorld[] =
+    "++++++++++[>+++++++>++++++++++>+++>+<<<<-]>++.>+.+++++++..+++.>++.<<"
+    "+++++++++++++++.>.+++.------.--------.>+.>.";
+
+static bool bf_write(void*, char c) {
+  return putchar(c) != EOF;
+}
+
+static int bf_read(void*) {
+  int c = getchar();
+  if (c == EOF) {
+    return kBrainfuckEOF;
+  } else {
+    return c;
+  }
+}
+
+int main() {
+  void* memory = calloc(1024, 1);
+  if (memory == NULL) {
+    fputs("Unable to allocate memory for Brainfuck memory\n", stderr);
+    return 1;
+  }
+
+  BrainfuckStatic<kHelloWorld>::run(bf_read, NULL, bf_write, NULL, memory);
+  free(memory);
+  return 0;
+}
@@ -0,0 +1,28 @@
+Prints "A" if cells have at least 16 bits and "B" if cells have at least 32 bits
+
+Cell 0 = 256 which is 0 for 8 bit cells
+++++++++[>++++++++<-]>[<++++>-]<
+[[-]>>++++++++[<++++++++>-]<+.[-]<]
+
+Cell 0 = 256 again
+++++++++[>++++++++<-]>[<++++>-]<
+Cell 1 = cell 0 * 256 which is 0 for 16 bit cells
+[>
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+++++++++++++++++
+<-]>
+[[-]>++++++++[<++++++++>-]<++.[-]]
@@ -0,0 +1,9 @@
+[This loop is never entered because every cell starts at zero so the
+ commands in it e.g. . and , must never run]
+Read a byte then clear it and count up to the letter A
+,[-]+++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++
+.
+Clear the cell twice then loop on the cleared cell which must not run
+[-][-][.]
+Build a newline from a known zero cell
+>++++++++++.
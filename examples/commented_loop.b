@@ -0,0 +1,17 @@
+Count down from sixty five and add one to the next cell each time
++++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++
+[
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+This comment is inside the loop and is longer than the longest trace but it contains no commands so the loop can still be traced 
+>+<-]
+>.
@@ -0,0 +1,3 @@
+Echo each input byte and then count it down to zero one step at a time
+The number of steps is different for each byte
+,[.[-],]
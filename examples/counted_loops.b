@@ -0,0 +1,23 @@
+Run the same counting loops with a fixed count many times and then with a
+count that changes between the outer iterations
+
+Twelve phases with an initial count of three
+++++++++++++>>>>+++<<<<
+[
+  Ten rounds per phase
+  >++++++++++
+  [
+    Move the count into two cells and then move one of them back
+    >>>[<+<+>>-]<[>+<-]
+    Add the other to the total
+    <[>>>+<<<-]
+    <-
+  ]
+  Increase the count for the next phase
+  >>>+<<<<-
+]
+The total is ten times the sum of the counts from three to fourteen (mod 256)
+so adding sixty nine gives the letter A
+>>>>>+++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++ +++++
+++++.
+>++++++++++.
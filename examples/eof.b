@@ -0,0 +1,3 @@
+Prints the value stored by the read command at the end of input
+(after setting the cell to 1)
++,.
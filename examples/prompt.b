@@ -0,0 +1,3 @@
+Prints a question mark then echoes the input
+++++++++[>++++++++<-]>-.[-]<
+,[.,]
@@ -0,0 +1,11 @@
+Read a character and then write it and each of the next three characters
+three times using the same loop each time
+,
+>+++[<.>-]<+
+>+++[<.>-]<+
+>+++[<.>-]<+
+>+++[<.>-]<
+Echo the next six characters using the same loop twice
+>>+++[<,.>-]<<
+>>+++[<,.>-]<<
+>>++++++++++.
@@ -17,6 +17,7 @@ import time
 import unittest
 
 EXECUTABLE_PATH = os.path.join(os.curdir, 'bf')
+STATIC_EXAMPLE_PATH = os.path.join(os.curdir, 'bf_static_example')
 
 
 def _check_datapointer_in_range(commands, restore_offset):
@@ -224,6 +225,55 @@ class TestExecutable(unittest.TestCase):
         self.assertEqual(stdout, 'Hello World!\n')
         self.assertEqual(stderr, '')
 
+    def test_source_from_stdin(self):
+        test_hello_world = os.path.join(os.curdir, 'examples', 'hello.b')
+        with open(test_hello_world, 'rb') as f:
+            source = f.read()
+
+        for mode in ['--mode=i', '--mode=cag', '--mode=jit']:
+            returncode, stdout, stderr = run_brainfuck(
+                args=[mode, '-'], stdin=source)
+            self.assertEqual(returncode, 0)
+            self.assertEqual(stdout, 'Hello World!\n')
+            self.assertEqual(stderr, '')
+
+    def test_source_from_pipe(self):
+        test_hello_world = os.path.join(os.curdir, 'examples', 'hello.b')
+        with open(test_hello_world, 'rb') as f:
+            source = f.read()
+
+        returncode, stdout, stderr = run_brainfuck(
+            args=['/dev/stdin'], stdin=source)
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, 'Hello World!\n')
+        self.assertEqual(stderr, '')
+
+    def test_missing_file(self):
+        returncode, stdout, stderr = run_brainfuck(
+            args=[os.path.join(os.curdir, 'examples', 'missing.b')])
+        self.assertEqual(returncode, 1)
+        self.assertEqual(stdout, '')
+        self.assertIn('Could not open file', stderr)
+
+    def test_pipelined_write_failure(self):
+        # The writes fail long before the later fragments are compiled so the
+        # runner is destroyed while its compilation threads are still running.
+        with tempfile.NamedTemporaryFile(suffix='.b') as brainfuck_source_file:
+            brainfuck_source_file.write(
+                ',' + '+' * 65 + '.' * 20000 + '>+[-]<' * 20000)
+            brainfuck_source_file.flush()
+
+            with open('/dev/full', 'w') as full:
+                run = subprocess.Popen(
+                    [EXECUTABLE_PATH, '--mode=cag', '--pipeline',
+                     '--fragment-ops=8', brainfuck_source_file.name],
+                    stdin=subprocess.PIPE,
+                    stdout=full,
+                    stderr=subprocess.PIPE)
+                _, stderr = run.communicate('a')
+        self.assertEqual(run.returncode, 0)
+        self.assertEqual(stderr, '')
+
     def test_with_bad_mode(self):
         test_hello_world = os.path.join(os.curdir, 'examples', 'hello.b')
 
@@ -242,6 +292,24 @@ class TestExecutable(unittest.TestCase):
         self.assertEqual(stdout, '')
         self.assertIn('Unexpected argument: --flag=unknown', stderr)
 
+    def test_with_bad_cell_bits(self):
+        test_hello_world = os.path.join(os.curdir, 'examples', 'hello.b')
+
+        returncode, stdout, stderr = run_brainfuck(
+            args=['--cell-bits=64', test_hello_world])
+        self.assertEqual(returncode, 1)
+        self.assertEqual(stdout, '')
+        self.assertIn('Unexpected cell bits: --cell-bits=64', stderr)
+
+    def test_with_bad_eof(self):
+        test_hello_world = os.path.join(os.curdir, 'examples', 'hello.b')
+
+        returncode, stdout, stderr = run_brainfuck(
+            args=['--eof=-2', test_hello_world])
+        self.assertEqual(returncode, 1)
+        self.assertEqual(stdout, '')
+        self.assertIn('Unexpected EOF behavior: --eof=-2', stderr)
+
     def test_with_mode_no_file(self):
         returncode, stdout, stderr = run_brainfuck(args=['--mode=jit'])
         self.assertEqual(returncode, 1)
@@ -253,18 +321,22 @@ class BrainfuckRunnerTestMixin(object):
     """A abstract class for testing a brainfuck execution mode.
 
     Subclasses must define a "MODE" class variable corresponding to their mode
-    flag e.g. "jit".
+    flag e.g. "jit". They may also define an "ARGS" class variable containing
+    additional flags.
     """
 
     MODE = None
+    ARGS = ()
 
     @classmethod
-    def run_brainfuck(cls, brainfuck_example, stdin=None):
+    def run_brainfuck(cls, brainfuck_example, stdin=None, args=()):
         test_brainfuck_path = os.path.join(
             os.curdir, 'examples', brainfuck_example)
 
         return run_brainfuck(
-            ['--mode=%s' % cls.MODE, test_brainfuck_path], stdin)
+            ['--mode=%s' % cls.MODE] + list(cls.ARGS) + list(args) +
+            [test_brainfuck_path],
+            stdin)
 
     def test_hello_world(self):
         returncode, stdout, stderr = self.run_brainfuck('hello.b')
@@ -282,6 +354,15 @@ class BrainfuckRunnerTestMixin(object):
         self.assertEqual(stdout, 'This should be echoed!')
         self.assertEqual(stderr, '')
 
+    def test_output_before_input(self):
+        returncode, stdout, stderr = self.run_brainfuck(
+            'prompt.b',
+            stdin='This should be echoed!')
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, '?This should be echoed!')
+        self.assertEqual(stderr, '')
+
     def test_unbalanced_block(self):
         returncode, stdout, stderr = self.run_brainfuck('unbalanced_block.b')
 
@@ -319,12 +400,153 @@ class BrainfuckRunnerTestMixin(object):
         self.assertEqual(stdout, 'Hello World!\n')
         self.assertEqual(stderr, '')
 
+    def test_clear(self):
+        for stdin in ['', 'x', '\xff']:
+            returncode, stdout, stderr = self.run_brainfuck(
+                'clear.b', stdin=stdin)
+
+            self.assertEqual(returncode, 0)
+            self.assertEqual(stdout, 'A\n')
+            self.assertEqual(stderr, '')
+
+    def test_count_down(self):
+        stdin = ''.join([chr(random.randrange(1, 256)) for _ in range(1000)])
+        returncode, stdout, stderr = self.run_brainfuck(
+            'count_down.b', stdin=stdin)
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, stdin)
+        self.assertEqual(stderr, '')
+
+    def test_counted_loops(self):
+        returncode, stdout, stderr = self.run_brainfuck('counted_loops.b')
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, 'A\n')
+        self.assertEqual(stderr, '')
+
+    def test_repeated_loops(self):
+        returncode, stdout, stderr = self.run_brainfuck(
+            'repeated_loops.b', stdin='aXYZxyz')
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, 'aaabbbcccdddXYZxyz\n')
+        self.assertEqual(stderr, '')
+
+    def test_deep_nesting(self):
+        returncode, stdout, stderr = self.run_brainfuck(
+            'deep_nesting.b', stdin='A')
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, 'A')
+        self.assertEqual(stderr, '')
+
+    def test_offset_tables(self):
+        expected = ''.join(chr(i) for i in range(1, 21)) * 2 + '\x01' * 300
+        for cell_bits in [8, 16, 32]:
+            returncode, stdout, stderr = self.run_brainfuck(
+                'offset_tables.b',
+                stdin='x',
+                args=['--cell-bits=%d' % cell_bits])
+
+            self.assertEqual(returncode, 0)
+            self.assertEqual(stdout, expected)
+            self.assertEqual(stderr, '')
+
+    def test_commented_loop(self):
+        returncode, stdout, stderr = self.run_brainfuck('commented_loop.b')
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, 'A')
+        self.assertEqual(stderr, '')
+
+    def test_large_program(self):
+        # Large enough to be split into several fragments by the compiler.
+        text = ''.join([chr(random.randrange(32, 127)) for _ in range(8000)])
+        brainfuck_code = ',' + ''.join(
+            ['[-]>[-]%s[<++++++++>-]<%s.' % ('+' * (ord(c) // 8),
+                                              '+' * (ord(c) % 8))
+             for c in text])
+        with tempfile.NamedTemporaryFile(
+            suffix='.b', delete=False) as brainfuck_source_file:
+            brainfuck_source_file.write(brainfuck_code)
+            brainfuck_source_file.close()
+            returncode, stdout, stderr = self.run_brainfuck(
+                brainfuck_source_file.name)
+            os.unlink(brainfuck_source_file.name)
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, text)
+        self.assertEqual(stderr, '')
+
+    def test_cell_bits(self):
+        for cell_bits, expected_stdout in [('8', ''),
+                                           ('16', 'A'),
+                                           ('32', 'AB')]:
+            returncode, stdout, stderr = self.run_brainfuck(
+                'cell_bits.b', args=['--cell-bits=%s' % cell_bits])
+
+            self.assertEqual(returncode, 0)
+            self.assertEqual(stdout, expected_stdout)
+            self.assertEqual(stderr, '')
+
+    def test_hello_world_cell_bits(self):
+        for cell_bits in ['16', '32']:
+            returncode, stdout, stderr = self.run_brainfuck(
+                'hello.b', args=['--cell-bits=%s' % cell_bits])
+
+            self.assertEqual(returncode, 0)
+            self.assertEqual(stdout, 'Hello World!\n')
+            self.assertEqual(stderr, '')
+
+    def test_eof(self):
+        for cell_bits in ['8', '16', '32']:
+            for eof, expected_stdout in [('0', '\x00'),
+                                         ('-1', '\xff'),
+                                         ('unchanged', '\x01')]:
+                returncode, stdout, stderr = self.run_brainfuck(
+                    'eof.b',
+                    args=['--cell-bits=%s' % cell_bits, '--eof=%s' % eof])
+
+                self.assertEqual(returncode, 0)
+                self.assertEqual(stdout, expected_stdout)
+                self.assertEqual(stderr, '')
+
+    def test_eof_not_reached(self):
+        returncode, stdout, stderr = self.run_brainfuck(
+            'eof.b', stdin='a', args=['--eof=unchanged'])
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, 'a')
+        self.assertEqual(stderr, '')
+
 
 # pylint: disable=too-few-public-methods
 class TestCompileAndGo(unittest.TestCase, BrainfuckRunnerTestMixin):
     MODE = 'cag'
 
 
+# pylint: disable=too-few-public-methods
+class TestPipelinedCompileAndGo(unittest.TestCase, BrainfuckRunnerTestMixin):
+    MODE = 'cag'
+    ARGS = ('--pipeline',)
+
+
+# pylint: disable=too-few-public-methods
+class TestFragmentedCompileAndGo(unittest.TestCase, BrainfuckRunnerTestMixin):
+    """Compiles even small programs as many fragments."""
+    MODE = 'cag'
+    ARGS = ('--fragment-ops=8',)
+
+
+# pylint: disable=too-few-public-methods
+class TestFragmentedPipelinedCompileAndGo(unittest.TestCase,
+                                          BrainfuckRunnerTestMixin):
+    """Compiles and runs even small programs as many fragments."""
+    MODE = 'cag'
+    ARGS = ('--pipeline', '--fragment-ops=8')
+
+
 # pylint: disable=too-few-public-methods
 class TestInterpreter(unittest.TestCase, BrainfuckRunnerTestMixin):
     MODE = 'i'
@@ -335,6 +557,99 @@ class TestJIT(unittest.TestCase, BrainfuckRunnerTestMixin):
     MODE = 'jit'
 
 
+class TestBatch(unittest.TestCase):
+    """Tests running a Brainfuck program once for each line of input."""
+
+    @staticmethod
+    def run_brainfuck(brainfuck_example, stdin):
+        test_brainfuck_path = os.path.join(
+            os.curdir, 'examples', brainfuck_example)
+
+        return run_brainfuck(['--batch', test_brainfuck_path], stdin)
+
+    def test_hello_world(self):
+        returncode, stdout, stderr = self.run_brainfuck('hello.b', '\n' * 40)
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, 'Hello World!\n' * 40)
+        self.assertEqual(stderr, '')
+
+    def test_cat(self):
+        returncode, stdout, stderr = self.run_brainfuck(
+            'cat.b',
+            stdin='This\nshould be\n\nechoed!')
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, 'Thisshould beechoed!')
+        self.assertEqual(stderr, '')
+
+    def test_cell_bits(self):
+        returncode, stdout, stderr = run_brainfuck(
+            ['--batch', '--cell-bits=32',
+             os.path.join(os.curdir, 'examples', 'cell_bits.b')],
+            '\n' * 3)
+
+        self.assertEqual(returncode, 0)
+        self.assertEqual(stdout, 'AB' * 3)
+        self.assertEqual(stderr, '')
+
+    def test_unbalanced_block(self):
+        returncode, stdout, stderr = self.run_brainfuck(
+            'unbalanced_block.b', '\n')
+
+        self.assertEqual(returncode, 1)
+        self.assertEqual(stdout, '')
+        self.assertIn('Unable to find loop end in block starting with: [++',
+                      stderr)
+
+    def _check_consistency_with_code(self, brainfuck_code, lines):
+        with tempfile.NamedTemporaryFile(
+            suffix='.b', delete=False) as brainfuck_source_file:
+            brainfuck_source_file.write(brainfuck_code)
+            brainfuck_source_file.close()
+
+            returncode, batch_stdout, stderr = run_brainfuck(
+                ['--batch', brainfuck_source_file.name],
+                ''.join([line + '\n' for line in lines]))
+            self.assertEqual(returncode, 0)
+            self.assertEqual(stderr, '')
+
+            stdouts = []
+            for line in lines:
+                returncode, stdout, stderr = run_brainfuck(
+                    ['--mode=i', brainfuck_source_file.name], line)
+                self.assertEqual(returncode, 0)
+                stdouts.append(stdout)
+
+            self.assertSequenceEqual(''.join(stdouts), batch_stdout,
+                                     'output does not match for file %s' % (
+                                         brainfuck_source_file.name))
+            os.unlink(brainfuck_source_file.name)
+
+    @_repeat_for_seconds(2)
+    def test_consistency_with_random_loop_input(self):
+        brainfuck_code = generate_brainfuck_code('<>+-[],.', 80, 2)
+        lines = [''.join([chr(random.randrange(11, 256))
+                          for _ in range(random.randrange(10))])
+                 for _ in range(40)]
+        self._check_consistency_with_code(brainfuck_code, lines)
+
+
+class TestStatic(unittest.TestCase):
+    """Tests Brainfuck code translated into C++ at compile time."""
+
+    def test_hello_world(self):
+        run = subprocess.Popen([STATIC_EXAMPLE_PATH],
+                               stdin=subprocess.PIPE,
+                               stdout=subprocess.PIPE,
+                               stderr=subprocess.PIPE)
+        stdout, stderr = run.communicate('')
+
+        self.assertEqual(run.returncode, 0)
+        self.assertEqual(stdout, 'Hello World!\n')
+        self.assertEqual(stderr, '')
+
+
 class ConsistentOutputTest(unittest.TestCase):
     """Check that the various BrainfuckRunners produce consistent output."""
 
@@ -349,7 +664,10 @@ class ConsistentOutputTest(unittest.TestCase):
             brainfuck_source_file.close()
 
             stdouts = []
-            for klass in [TestCompileAndGo, TestInterpreter, TestJIT]:
+            for klass in [TestCompileAndGo, TestPipelinedCompileAndGo,
+                          TestFragmentedCompileAndGo,
+                          TestFragmentedPipelinedCompileAndGo,
+                          TestInterpreter, TestJIT]:
                 returncode, stdout, stderr = klass.run_brainfuck(
                     brainfuck_source_file.name, stdin=brainfuck_input)
                 self.assertEqual(returncode, 0)